@@ -0,0 +1,110 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// build time of a command dictionary: incremental (command_node::add() one
+// word at a time + build(tree)) versus bulk (build(commands): sort + one pass)
+//
+// usage: bench_dictionary [commands (100000)] [repeat (5)]
+
+#include "commands.h"
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <memory>
+#include <set>
+
+using namespace libchars;
+
+static double now_ms()
+{
+    struct timeval T;
+    gettimeofday(&T, NULL);
+    return T.tv_sec * 1000.0 + T.tv_usec / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = (argc > 1) ? strtoul(argv[1],NULL,0) : 100000;
+    size_t repeat = (argc > 2) ? strtoul(argv[2],NULL,0) : 5;
+    srand(1);
+
+    // random commands of 1-3 words (3-8 lower case letters)
+    std::vector<command*> commands;
+    std::vector<std::string> cmd_strs;
+    std::set<std::string> seen;
+    while (commands.size() < n) {
+        std::string cmd_str;
+        size_t n_words = 1 + rand() % 3;
+        for (size_t w = 0; w < n_words; ++w) {
+            if (w > 0)
+                cmd_str += ' ';
+            size_t length = 3 + rand() % 6;
+            for (size_t i = 0; i < length; ++i)
+                cmd_str += (char)('a' + rand() % 26);
+        }
+        if (!seen.insert(cmd_str).second)
+            continue;
+        cmd_strs.push_back(cmd_str);
+        commands.push_back(new command(cmd_str, NULL, (command::filter_t)1 << (rand() % 4)));
+    }
+
+    double best_tree = 0, best_bulk = 0;
+    size_t nodes_tree = 0, nodes_bulk = 0;
+    for (size_t r = 0; r < repeat; ++r) {
+        double t0 = now_ms();
+        {
+            command_node tree;
+            for (size_t c = 0; c < commands.size(); ++c) {
+                std::unique_ptr<token> words(libchars::lexer(cmd_strs[c]));
+                token *T = words.get();
+                command_node *cn = tree.add(T->value, 1);
+                for (T = T->next; T != NULL; T = T->next)
+                    cn = cn->add_root(1)->add(T->value, 1);
+                cn->associate(commands[c]);
+            }
+            command_dictionary D;
+            D.build(tree);
+            nodes_tree = D.size();
+        }
+        double t1 = now_ms();
+        {
+            command_dictionary D;
+            D.build(commands);
+            nodes_bulk = D.size();
+        }
+        double t2 = now_ms();
+
+        if (r == 0 || (t1 - t0) < best_tree)
+            best_tree = t1 - t0;
+        if (r == 0 || (t2 - t1) < best_bulk)
+            best_bulk = t2 - t1;
+    }
+
+    printf("%zu commands, best of %zu\n", n, repeat);
+    printf("  incremental (command_node + build(tree)): %9.2f ms  (%zu nodes)\n", best_tree, nodes_tree);
+    printf("  bulk (build(commands)):                   %9.2f ms  (%zu nodes)\n", best_bulk, nodes_bulk);
+
+    for (size_t c = 0; c < commands.size(); ++c)
+        delete commands[c];
+    return 0;
+}
@@ -31,6 +31,7 @@ SOFTWARE.
 #include <algorithm>
 
 #include <assert.h>
+#include <string.h>
 
 namespace libchars {
 
@@ -56,31 +57,34 @@ namespace libchars {
 
     command_node::command_node(const std::string &part_) :
         part(part_),mask(0),hidden(false),cmd(NULL),
-        head(NULL),tail(NULL),
-        next(NULL),start(NULL) {}
+        start(NULL) {}
 
     command_node::command_node() :
         mask(0),hidden(false),cmd(NULL),
-        head(NULL),tail(NULL),
-        next(NULL),start(NULL) {}
+        start(NULL) {}
 
     command_node::~command_node()
     {
-        delete head;
-        delete start;
-        delete next;
+        clear();
+    }
+
+    command_node *command_node::child(char c) const
+    {
+        return first.test(c) ? children[first.rank(c)] : NULL;
     }
 
     void command_node::add_node(command_node *parent, command_node *n)
     {
         LC_LOG_VERBOSE("parent[%p/%s] + n[%p/%s]",parent,parent->part.c_str(),n,n->part.c_str());
         if (parent != NULL) {
-            if (parent->head == NULL) {
-                parent->head = parent->tail = n;
+            // children are kept in order of first character (rank in bitmap)
+            char c = n->part.at(0);
+            if (parent->first.test(c)) {
+                parent->children[parent->first.rank(c)] = n;
             }
             else {
-                parent->tail->next = n;
-                parent->tail = n;
+                parent->children.insert(parent->children.begin() + parent->first.rank(c), n);
+                parent->first.set(c);
             }
         }
     }
@@ -103,16 +107,15 @@ namespace libchars {
 
     void command_node::clear()
     {
-        delete head;
+        for (size_t i = 0; i < children.size(); ++i)
+            delete children[i];
         delete start;
-        delete next;
 
         mask = 0;
         hidden = false;
         cmd = NULL;
-        head = NULL;
-        tail = NULL;
-        next = NULL;
+        children.clear();
+        first.clear();
         start = NULL;
     }
 
@@ -122,125 +125,44 @@ namespace libchars {
 
         mask |= mask_; // always update root mask
 
-        if (head == NULL) {
-            // no need to search; just add whole word
-            LC_LOG_VERBOSE("add-new-root");
-            return add_node(this,word,mask_,hidden_);
-        }
-        else {
-            size_t ti = 0; // tree index (cumulative)
-            size_t wi = 0; // index of first character in partial word (wi <= ti)
-            size_t si = 0; // index into search word (0..length)
-
-            command_node *root = this;
-            command_node *prev = NULL;
-            command_node *n = head;
-
-            while (n != NULL && si < word.length()) {
-                LC_LOG_VERBOSE("root[%p] prev[%p] n[%p] ti[%zu] wi[%zu] si[%zu]",root,prev,n,ti,wi,si);
-                char c = word.at(si);
-                size_t ri = (ti - wi); // index relative to partial dictionary word
-                if (ri == 0) {
-                    // check for match in first letter, else go to next command_node
-                    if (n->part.at(ri) == c) {
-                        ++si;
-                        ++ti;
-                    }
-                    else if (n->next == NULL) {
-                        return add_node(root,word.substr(si),mask_,hidden_);
-                    }
-                    else {
-                        prev = n;
-                        n = n->next;
-                    }
-                }
-                else if (ri < n->part.length()) {
-                    // check for match in current part
-                    if (n->part.at(ri) == c) {
-                        ++si;
-                        ++ti;
-                    }
-                    else {
-                        // mismatch = split + add new part
-                        LC_LOG_VERBOSE("mismatch->split");
-                        std::string part = n->part;
-                        command_node *nn = new command_node;
-                        nn->part.assign(part,0,ri);
-                        nn->mask = n->mask | mask_;
-                        nn->next = n->next;
-                        n->part.assign(part.substr(ri));
-                        n->next = NULL;
-                        // split = move existing command_node down one level
-                        add_node(nn,n);
-                        if (prev == NULL) {
-                            root->head = nn;
-                        }
-                        else {
-                            prev->next = nn;
-                        }
-                        if (nn->next == NULL) {
-                            root->tail = nn;
-                        }
-                        return add_node(nn,word.substr(si),mask_,hidden_);
-                    }
-                }
-                else {
-                    // reached end of current part; go down one level if possible
-                    if (n->head == NULL) {
-                        n->mask |= mask_;
-                        return add_node(n,word.substr(si),mask_,hidden_);
-                    }
-                    else {
-                        wi = ti;
-                        root = n;
-                        root->mask |= mask_;
-                        prev = NULL;
-                        n = n->head;
-                    }
-                }
-            }
+        command_node *n = this;
+        size_t si = 0; // index into search word (0..length)
 
-            LC_LOG_VERBOSE("END1: root[%p] prev[%p] n[%p] ti[%zu] si[%zu] word.length[%zu]",root,prev,n,ti,si,word.length());
-
-            if (n == NULL) 
-                n = root;
-
-            LC_LOG_VERBOSE("END2: n[%p] wi[%zu] part.length[%zu]",n,wi,n->part.length());
-
-            if (si < word.length()) {
+        while (si < word.length()) {
+            // select child on first character
+            command_node *c = n->child(word.at(si));
+            if (c == NULL) {
                 // not found --> add rest of word
-                n->mask |= mask_;
                 return add_node(n,word.substr(si),mask_,hidden_);
             }
-            else if (si < (wi + n->part.length())) {
-                // found, but only partially --> split + add new part
-                LC_LOG_VERBOSE("found(partially)->split");
-                size_t ri = (si - wi); // index relative to partial dictionary word
-                std::string part = n->part;
-                n->part.assign(part,0,ri);
-                command_node *head__ = n->head;
-                command_node *tail__ = n->tail;
-                // move command node content to new node
-                n->head = n->tail = NULL;
-                command_node *nn = add_node(n,part.substr(ri),n->mask,n->hidden);
-                nn->cmd = n->cmd;
-                nn->head = head__;
-                nn->tail = tail__;
-                nn->start = n->start;
-                // clean up current node
-                n->mask |= mask_;
-                n->cmd = NULL;
-                n->hidden = hidden_;
-                n->start = NULL;
+
+            size_t ri = 0; // index relative to partial dictionary word
+            while (ri < c->part.length() && si < word.length() && c->part.at(ri) == word.at(si)) {
+                ++ri;
+                ++si;
             }
-            else {
-                // duplicate
-                LC_LOG_VERBOSE("duplicate node");
-                n->mask |= mask_;
+
+            if (ri < c->part.length()) {
+                // mismatch or found partially = split; move existing node down one level
+                LC_LOG_VERBOSE("split[%s@%zu]",c->part.c_str(),ri);
+                command_node *nn = new command_node(c->part.substr(0,ri));
+                nn->mask = c->mask | mask_;
+                nn->hidden = c->hidden && hidden_;
+                c->part.erase(0,ri);
+                add_node(n,nn); // replaces 'c' (same first character)
+                add_node(nn,c);
+                if (si < word.length())
+                    return add_node(nn,word.substr(si),mask_,hidden_);
+                return nn;
             }
 
-            return n;
+            c->mask |= mask_;
+            n = c;
         }
+
+        // duplicate / end of word on existing node
+        LC_LOG_VERBOSE("existing node");
+        return n;
     }
 
     command_node *command_node::add_root(command::filter_t mask_, bool hidden_)
@@ -276,288 +198,1122 @@ namespace libchars {
             if (start != NULL)
                 start->dump(level);
 
-            command_node *n = head;
-            while (n != NULL) {
-                n->dump(level);
-                n = n->next;
-            }
+            for (size_t i = 0; i < children.size(); ++i)
+                children[i]->dump(level);
+        }
+    }
+
+
+    char *word_buffer::fit(size_t length)
+    {
+        n = length;
+        if (length < sizeof(fixed)) {
+            s = fixed;
         }
+        else {
+            spill.resize(length + 1);
+            s = &spill[0];
+        }
+        return s;
     }
 
+    void word_buffer::assign(const char *str, size_t length)
+    {
+        char *buf = fit(length);
+        memmove(buf, str, length);
+        buf[length] = 0;
+    }
 
-    command_cursor::command_cursor(command_node *r, size_t r_idx) :
-        root(r),root_idx(r_idx),idx(0) {}
+    dictionary_cursor::dictionary_cursor(const command_dictionary &d) :
+        depth(0),w_length(0),dict(&d),root(0),root_idx(0),idx(0) {}
 
-    command_cursor::command_cursor(const command_cursor &n) :
-        root(n.current()),idx(0)
+    void dictionary_cursor::push(index_t n)
+    {
+        // beyond the fixed stack only for words longer than MAX_WORD
+        if (depth < command_dictionary::MAX_WORD) {
+            S[depth++] = n;
+        }
+        else {
+            S_deep.resize(depth - command_dictionary::MAX_WORD);
+            S_deep.push_back(n);
+            ++depth;
+        }
+    }
+
+    void dictionary_cursor::branch()
     {
-        if (n.S.empty())
-            root_idx = n.root_idx + n.idx;
+        index_t n = current();
+        if (depth == 0)
+            root_idx += idx;
         else
-            root_idx = n.idx;
+            root_idx = idx;
+        root = n;
+        rewind();
     }
 
-    bool command_cursor::command(command::filter_t mask, bool ignore_hidden) const
+    command_dictionary::index_t dictionary_cursor::next_sibling(command::filter_t mask, bool ignore_hidden) const
     {
-        return valid() &&
-               (current()->mask & mask) != 0 &&
-               (!current()->hidden || ignore_hidden) &&
-               current()->cmd != NULL &&
-               (current()->cmd->mask & mask) != 0 &&
-               (!current()->cmd->hidden || ignore_hidden);
+        // at most 255 siblings (one per first character)
+        if (depth == 0)
+            return command_dictionary::NONE;
+        index_t parent = (depth > 1) ? path(depth - 2) : root;
+        const command_dictionary::node &P = node(parent);
+        for (index_t n = path(depth - 1) + 1; n < (P.child + P.n_children); ++n)
+            if (dict->reachable(n, mask, ignore_hidden))
+                return n;
+        return command_dictionary::NONE;
     }
 
-    bool command_cursor::subword(command::filter_t mask, bool ignore_hidden) const
+    label_view dictionary_cursor::segment(size_t k) const
+    {
+        // root: from root_idx on; top of stack: up to idx; others: full label
+        index_t n = (k == 0) ? root : path(k - 1);
+        size_t from = (k == 0) ? root_idx : 0;
+        size_t length = (k == depth) ? idx : (node(n).label_length - from);
+        return label_view(dict->original(n) + from, length);
+    }
+
+    size_t dictionary_cursor::word(char *buf, size_t size) const
     {
-        return valid() &&
-               (current()->mask & mask) != 0 &&
-               (!current()->hidden || ignore_hidden) &&
-               current()->start != NULL;
+        size_t n = 0;
+        for (size_t k = 0; dict != NULL && k <= depth; ++k) {
+            label_view s = segment(k);
+            if (n + 1 < size)
+                memcpy(buf + n, s.str, std::min(s.length, size - 1 - n));
+            n += s.length;
+        }
+        if (size > 0)
+            buf[std::min(n, size - 1)] = 0;
+        return n;
     }
 
-    size_t command_cursor::current_length() const
+    size_t dictionary_cursor::word(word_buffer &w) const
     {
-        if (S.empty()) {
-            if (root != NULL && root_idx < root->part.length())
-                return (root->part.length() - root_idx);
+        // in place if it fits, otherwise once more into room for all of it
+        size_t n = word(w.fit(command_dictionary::MAX_WORD), command_dictionary::MAX_WORD + 1);
+        if (n > command_dictionary::MAX_WORD)
+            word(w.fit(n), n + 1);
+        else
+            w.fit(n);
+        return n;
+    }
+
+    int dictionary_cursor::compare(const dictionary_cursor &c) const
+    {
+        // walked label by label on both paths; no copy of either word
+        size_t k = 0, ck = 0, i = 0, ci = 0;
+        label_view a = segment(0), b = c.segment(0);
+        for (;;) {
+            while (i == a.length && k < depth) {
+                a = segment(++k);
+                i = 0;
+            }
+            while (ci == b.length && ck < c.depth) {
+                b = c.segment(++ck);
+                ci = 0;
+            }
+            if (i == a.length || ci == b.length)
+                return (i == a.length) ? ((ci == b.length) ? 0 : -1) : 1;
+            size_t n = std::min(a.length - i, b.length - ci);
+            int r = memcmp(a.str + i, b.str + ci, n);
+            if (r != 0)
+                return r;
+            i += n;
+            ci += n;
+        }
+    }
+
+    bool dictionary_cursor::command(command::filter_t mask, bool ignore_hidden) const
+    {
+        if (!valid())
+            return false;
+        const command_dictionary::node &n = node(current());
+        return n.cmd != command_dictionary::NONE &&
+               dict->visible(n.cmd, mask, ignore_hidden);
+    }
+
+    bool dictionary_cursor::subword(command::filter_t mask, bool ignore_hidden) const
+    {
+        if (!valid())
+            return false;
+        // further words available (checked on root of next word, since the
+        // current node may also lead to other commands)
+        const command_dictionary::node &n = node(current());
+        return n.start != command_dictionary::NONE &&
+               dict->reachable(n.start, mask, ignore_hidden);
+    }
+
+    size_t dictionary_cursor::current_length() const
+    {
+        if (!valid())
+            return 0;
+        if (depth == 0) {
+            if (root_idx < node(root).label_length)
+                return (node(root).label_length - root_idx);
         }
         else {
-            command_node *n = S.top();
-            if (n != NULL)
-                return n->part.length();
+            return node(path(depth - 1)).label_length;
         }
         return 0;
     }
 
-    char command_cursor::current_char() const
+    char dictionary_cursor::current_char() const
     {
-        if (S.empty()) {
-            if (root != NULL && root_idx < root->part.length())
-                return root->part.at(root_idx + idx);
+        if (!valid())
+            return 0;
+        if (depth == 0) {
+            if ((root_idx + idx) < node(root).label_length)
+                return dict->label(root)[root_idx + idx];
         }
         else {
-            command_node *n = S.top();
-            if (n != NULL && idx < n->part.length())
-                return n->part.at(idx);
+            if (idx < node(path(depth - 1)).label_length)
+                return dict->label(path(depth - 1))[idx];
         }
         return 0;
     }
 
-    void command_cursor::rewind()
+    void dictionary_cursor::rewind()
     {
-        command_node_stack_t empty;
-        std::swap(S,empty);
-        w.clear();
+        depth = 0;
+        w_length = 0;
         idx = 0;
     }
 
-    std::string command_cursor::remainder() const
+    label_view dictionary_cursor::remainder() const
     {
-        if (S.empty()) {
-            if (root != NULL && (root_idx + idx) < root->part.length())
-                return root->part.substr(root_idx + idx);
-        }
-        else {
-            command_node *n = S.top();
-            if (n != NULL && idx < n->part.length())
-                return n->part.substr(idx);
-        }
-        return "";
+        if (!valid())
+            return label_view();
+        index_t n = current();
+        size_t offset = (depth == 0) ? (root_idx + idx) : idx;
+        if (offset < node(n).label_length)
+            return label_view(dict->original(n) + offset, node(n).label_length - offset);
+        return label_view();
     }
 
-    bool command_cursor::next()
+    bool dictionary_cursor::next(command::filter_t mask, bool ignore_hidden)
     {
-        // depth first search
-        command_node *n = current();
-        if (n == NULL)
+        // depth first search; only into subtrees with commands that pass the
+        // filter, so every node visited leads to a result
+        if (!valid())
             return false;
+        index_t n = current();
 
-        /*
-        if (S.empty())
-            LC_LOG_VERBOSE("root[%p]@%zu; w[%s]",root,idx,w.c_str());
-        else
-            LC_LOG_VERBOSE("n[%p]@%zu; w[%s]",n,idx,w.c_str());
-        */
-
-        std::string rstr = remainder();
-        if (!rstr.empty()) {
-            //LC_LOG_VERBOSE("w + [%s]",rstr.c_str());
-            w.append(rstr);
-            idx += rstr.length();
+        size_t rlength = remainder().length;
+        if (rlength > 0) {
+            w_length += rlength;
+            idx += rlength;
             return true;
         }
-        else if (n->head != NULL) {
-            //LC_LOG_VERBOSE("push[%p;next=%p]",n->head,n->head->next);
-            S.push(n->head);
+        index_t child = command_dictionary::NONE;
+        for (index_t k = node(n).child; k < (node(n).child + node(n).n_children); ++k) {
+            if (dict->reachable(k, mask, ignore_hidden)) {
+                child = k;
+                break;
+            }
+        }
+        if (child != command_dictionary::NONE) {
+            push(child);
             idx = 0;
             return true;
         }
         else {
-            while (!S.empty() && n != NULL && n->next == NULL) {
-                if (idx > 0 && idx <= w.length())
-                    w.erase(w.length() - idx);
+            while (depth > 0 && next_sibling(mask, ignore_hidden) == command_dictionary::NONE) {
+                w_length -= std::min(idx, w_length);
 
-                //LC_LOG_VERBOSE("pop[%p;next=%p]",S.top(),S.top()->next);
-                S.pop();
+                --depth;
 
-                if (S.empty()) {
-                    if (root != NULL && root_idx < root->part.length())
-                        idx = root->part.length() - root_idx;
+                if (depth == 0) {
+                    if (root_idx < node(root).label_length)
+                        idx = node(root).label_length - root_idx;
                     else
                         idx = 0;
                 }
                 else {
-                    if ((n = S.top()) != NULL)
-                        idx = n->part.length();
-                    else
-                        idx = 0;
+                    idx = node(path(depth - 1)).label_length;
                 }
             }
 
-            if (idx > 0 && idx <= w.length())
-                w.erase(w.length() - idx);
+            w_length -= std::min(idx, w_length);
 
             idx = 0;
-            if (S.empty() || n == NULL) {
-                w.clear();
+            if (depth == 0) {
+                w_length = 0;
                 return false;
             }
 
-            n = n->next;
-            //LC_LOG_VERBOSE("pop[%p;next=%p]",S.top(),S.top()->next);
-            S.pop();
+            replace_top(next_sibling(mask, ignore_hidden));
+            return true;
+        }
+    }
 
-            if (n != NULL) {
-                //LC_LOG_VERBOSE("push[%p;next=%p]",n,n->next);
-                S.push(n);
-                return true;
+    bool dictionary_cursor::next_root()
+    {
+        if (!valid())
+            return false;
+        const command_dictionary::node &n = node(current());
+        size_t offset = (depth == 0) ? (root_idx + idx) : idx;
+        if (n.start != command_dictionary::NONE && offset >= n.label_length) {
+            root = n.start;
+            root_idx = 0;
+            rewind();
+            return true;
+        }
+        return false;
+    }
+
+    bool dictionary_cursor::find(const char *search, size_t length, command::filter_t mask, bool ignore_hidden)
+    {
+        if (length == 0)
+            return false;
+
+        size_t si = 0; // index into search (0..length)
+
+        while (valid() && si < length) {
+            char c = dict->fold(search[si]); // as stored in labels
+            if (!dict->reachable(current(), mask, ignore_hidden)) {
+                return false;
+            }
+            else if (idx >= current_length()) {
+                // end of current part; go down one level (child selected on first character)
+                index_t child = dict->child(current(), c);
+                if (child == command_dictionary::NONE)
+                    return false;
+                push(child);
+                idx = 0;
+            }
+            else if (c == current_char()) {
+                ++w_length;
+                ++si;
+                ++idx;
+            }
+            else {
+                return false;
             }
         }
+
+        if (!valid() || si < length)
+            return false;
+        return dict->reachable(current(), mask, ignore_hidden);
+    }
+
+    bool dictionary_cursor::expand(command::filter_t mask, bool ignore_hidden)
+    {
+        // a complete word is taken as is; otherwise walk down while exactly one
+        // subtree passes the filter (a node with a single word below it needs
+        // no look at the filter of its children)
+        if (!reachable(mask, ignore_hidden))
+            return false;
+        if (end() && (command(mask, ignore_hidden) || subword(mask, ignore_hidden)))
+            return true;
+
+        dictionary_cursor c(*this);
+        for (;;) {
+            size_t rlength = c.remainder().length;
+            c.w_length += rlength;
+            c.idx += rlength;
+
+            const command_dictionary::node &N = node(c.current());
+            bool word_end = c.command(mask, ignore_hidden) || c.subword(mask, ignore_hidden);
+            index_t child = command_dictionary::NONE;
+            if (N.words == 1) {
+                if (word_end)
+                    break;
+                child = N.child;
+            }
+            else {
+                for (index_t k = N.child; k < (N.child + N.n_children); ++k) {
+                    if (dict->reachable(k, mask, ignore_hidden)) {
+                        if (word_end || child != command_dictionary::NONE)
+                            return false; // ambiguous
+                        child = k;
+                    }
+                }
+                if (child == command_dictionary::NONE)
+                    break; // word_end: reachable node without reachable children
+            }
+            c.push(child);
+            c.idx = 0;
+        }
+        *this = c;
+        return true;
+    }
+
+    size_t dictionary_cursor::complete(command::filter_t mask, dictionary_cursor &common) const
+    {
+        // the words are counted by the dictionary (from the summaries where
+        // all words below a node are visible); their common part is the rest
+        // of the label, then down through the only child that leads to a
+        // visible word, as long as no word ends on the way
+        common = *this;
+        if (!reachable(mask, false))
+            return 0;
+        bool here = end() && (command(mask) || subword(mask));
+        size_t n = dict->count(current(), mask) - (here ? 1 : 0);
+        if (n == 0)
+            return 0;
+
+        for (;;) {
+            size_t rlength = common.remainder().length;
+            common.w_length += rlength;
+            common.idx += rlength;
+            if (common.w_length > w_length && (common.command(mask) || common.subword(mask)))
+                return n;
+            const command_dictionary::node &C = node(common.current());
+            index_t child = command_dictionary::NONE;
+            if ((C.every & mask) != 0) {
+                if (C.n_children == 1)
+                    child = C.child;
+            }
+            else {
+                for (index_t k = C.child; k < (C.child + C.n_children); ++k) {
+                    if (dict->reachable(k, mask, false)) {
+                        if (child != command_dictionary::NONE)
+                            return n;
+                        child = k;
+                    }
+                }
+            }
+            if (child == command_dictionary::NONE)
+                return n;
+            common.push(child);
+            common.idx = 0;
+        }
+    }
+
+    void dictionary_cursor::suggest(const std::string &search, command::filter_t mask, bool ignore_hidden, command_dictionary::suggestions_t &match) const
+    {
+        if (!valid())
+            return;
+        command_dictionary::suggestions_t words;
+        dict->suggest(search, words);
+        for (size_t k = 0; k < words.size(); ++k) {
+            dictionary_cursor c(*this);
+            if (c.find(words[k].second, mask, ignore_hidden) && c.end() &&
+                (c.command(mask, ignore_hidden) || c.subword(mask, ignore_hidden)))
+                match.push_back(words[k]);
+        }
+    }
+
+    void dictionary_cursor::collect(command::filter_t mask, bool ignore_hidden, std::vector<class command*> &match) const
+    {
+        if (valid())
+            dict->collect(current(), mask, ignore_hidden, match);
+    }
+
+    command_cursor::command_cursor(const std::vector<const command_dictionary*> &overlay) :
+        n_layers(0),shown(0),enumerating(false)
+    {
+        for (size_t i = 0; i < overlay.size() && n_layers < MAX_LAYERS; ++i)
+            L[n_layers++] = layer(*overlay[i]);
+        shown = n_layers;
+    }
+
+    command_cursor::command_cursor(const command_cursor &n) :
+        n_layers(n.n_layers),shown(n.n_layers),enumerating(false)
+    {
+        for (size_t i = 0; i < n_layers; ++i) {
+            L[i] = n.L[i];
+            L[i].c.branch();
+            L[i].pending = L[i].current = false;
+        }
+    }
+
+    const dictionary_cursor *command_cursor::spelled() const
+    {
+        if (!enumerating) {
+            // all live layers matched the same search string
+            for (size_t i = 0; i < n_layers; ++i)
+                if (L[i].alive)
+                    return &L[i].c;
+            return NULL;
+        }
+        return (shown < n_layers) ? &L[shown].c : NULL;
+    }
+
+    bool command_cursor::valid() const
+    {
+        for (size_t i = 0; i < n_layers; ++i)
+            if (L[i].alive)
+                return true;
         return false;
     }
 
-    bool command_cursor::next_root()
+    bool command_cursor::end() const
+    {
+        for (size_t i = 0; i < n_layers; ++i)
+            if (selected(L[i]))
+                return true;
+        return false;
+    }
+
+    size_t command_cursor::word_length() const
+    {
+        const dictionary_cursor *c = spelled();
+        return (c != NULL) ? c->word_length() : 0;
+    }
+
+    size_t command_cursor::word(char *buf, size_t size) const
+    {
+        const dictionary_cursor *c = spelled();
+        if (c != NULL)
+            return c->word(buf, size);
+        if (size > 0)
+            buf[0] = 0;
+        return 0;
+    }
+
+    size_t command_cursor::word(word_buffer &w) const
+    {
+        const dictionary_cursor *c = spelled();
+        if (c != NULL)
+            return c->word(w);
+        w.assign("", 0);
+        return 0;
+    }
+
+    bool command_cursor::command(command::filter_t mask, bool ignore_hidden) const
+    {
+        for (size_t i = 0; i < n_layers; ++i)
+            if (selected(L[i]) && L[i].c.command(mask, ignore_hidden))
+                return true;
+        return false;
+    }
+
+    bool command_cursor::subword(command::filter_t mask, bool ignore_hidden) const
     {
-        if (S.empty()) {
-            if (root != NULL && root->start != NULL && (root_idx + idx) >= root->part.length()) {
-                root = root->start;
-                root_idx = 0;
-                rewind();
+        for (size_t i = 0; i < n_layers; ++i)
+            if (selected(L[i]) && L[i].c.subword(mask, ignore_hidden))
                 return true;
+        return false;
+    }
+
+    command *command_cursor::get(command::filter_t mask, bool ignore_hidden) const
+    {
+        for (size_t i = 0; i < n_layers; ++i)
+            if (selected(L[i]) && L[i].c.command(mask, ignore_hidden))
+                return L[i].c.get();
+        return NULL;
+    }
+
+    bool command_cursor::next(command::filter_t mask, bool ignore_hidden)
+    {
+        // every layer enumerates its own dictionary in byte order; the lowest
+        // pending word is returned once for all layers positioned on it
+        enumerating = true;
+        for (size_t i = 0; i < n_layers; ++i) {
+            layer &l = L[i];
+            l.current = false;
+            if (l.alive && !l.pending) {
+                l.alive = false;
+                while (l.c.next(mask, ignore_hidden)) {
+                    if (l.c.end()) {
+                        l.alive = l.pending = true;
+                        break;
+                    }
+                }
             }
         }
-        else {
-            command_node *n = S.top();
-            if (n != NULL && n->start != NULL && idx >= n->part.length()) {
-                root = n->start;
-                root_idx = 0;
-                rewind();
-                return true;
+
+        shown = n_layers;
+        for (size_t i = 0; i < n_layers; ++i)
+            if (L[i].pending && (shown == n_layers || L[i].c.compare(L[shown].c) < 0))
+                shown = i;
+        if (shown == n_layers)
+            return false;
+
+        for (size_t i = 0; i < n_layers; ++i) {
+            if (L[i].pending && L[i].c.compare(L[shown].c) == 0) {
+                L[i].pending = false;
+                L[i].current = true;
             }
         }
-        return false;
+        return true;
     }
 
-    bool command_cursor::find(const std::string &search, command::filter_t mask, bool ignore_hidden)
+    void command_cursor::collect(command::filter_t mask, bool ignore_hidden, std::vector<class command*> &match) const
     {
-        if (search.empty())
+        for (size_t i = 0; i < n_layers; ++i)
+            if (L[i].alive)
+                L[i].c.collect(mask, ignore_hidden, match);
+    }
+
+    bool command_cursor::next_root()
+    {
+        enumerating = false;
+        bool found = false;
+        for (size_t i = 0; i < n_layers; ++i) {
+            if (L[i].alive)
+                L[i].alive = L[i].c.next_root();
+            found = found || L[i].alive;
+        }
+        return found;
+    }
+
+    bool command_cursor::find(const char *search, size_t length, command::filter_t mask, bool ignore_hidden)
+    {
+        enumerating = false;
+        bool found = false;
+        for (size_t i = 0; i < n_layers; ++i) {
+            if (L[i].alive)
+                L[i].alive = L[i].c.find(search, length, mask, ignore_hidden);
+            found = found || L[i].alive;
+        }
+        return found;
+    }
+
+    bool command_cursor::expand(command::filter_t mask, bool ignore_hidden)
+    {
+        // a layer without a word that passes the filter drops out; the others
+        // must all extend to the same word
+        enumerating = false;
+        if (end() && (command(mask, ignore_hidden) || subword(mask, ignore_hidden)))
+            return true;
+
+        bool found = false;
+        dictionary_cursor word;
+        for (size_t i = 0; i < n_layers; ++i) {
+            if (!L[i].alive || !L[i].c.reachable(mask, ignore_hidden))
+                continue;
+            dictionary_cursor c(L[i].c);
+            if (!c.expand(mask, ignore_hidden) || (found && c.compare(word) != 0))
+                return false;
+            word = c;
+            found = true;
+        }
+        if (!found)
             return false;
 
-        size_t si = 0; // index into search (0..length)
+        for (size_t i = 0; i < n_layers; ++i)
+            if (L[i].alive)
+                L[i].alive = L[i].c.reachable(mask, ignore_hidden) && L[i].c.expand(mask, ignore_hidden);
+        return true;
+    }
 
-        while (current() != NULL && si < search.length()) {
-            char c = search.at(si);
+    size_t command_cursor::complete(command::filter_t mask, command_cursor &common, bool &exact) const
+    {
+        // the words of all layers have the common extension of each layer in
+        // common; counts are added up, so a word in several layers counts
+        // more than once unless it is the only one
+        size_t n = 0, length = 0, layers = 0;
+        bool same = false; // every layer with words has the same single word
+        word_buffer ext, buf;
+        for (size_t i = 0; i < n_layers; ++i) {
+            if (!L[i].alive)
+                continue;
+            dictionary_cursor c;
+            size_t k = L[i].c.complete(mask, c);
+            if (k == 0)
+                continue;
+            size_t len = c.word(buf);
+            if (n == 0) {
+                ext.assign(buf.str(), len);
+                length = len;
+                same = (k == 1);
+            }
+            else {
+                same = same && k == 1 && len == length && memcmp(ext.str(), buf.str(), len) == 0;
+                size_t p = 0;
+                while (p < length && p < len && ext.str()[p] == buf.str()[p])
+                    ++p;
+                length = p;
+            }
+            n += k;
+            ++layers;
+        }
 
-            if (idx >= current_length()) {
-                if (current()->head != NULL && (current()->mask & mask) != 0 && (!current()->hidden || ignore_hidden)) {
-                    S.push(current()->head);
-                    idx = 0;
-                }
-                else {
-                    return false;
-                }
+        common = *this;
+        size_t from = word_length();
+        if (length > from)
+            common.find(ext.str() + from, length - from, mask);
+        exact = (layers <= 1 || same);
+        return (n > 0 && same) ? 1 : n;
+    }
+
+    void command_cursor::suggest(const std::string &search, command::filter_t mask, bool ignore_hidden, command_dictionary::suggestions_t &match) const
+    {
+        command_dictionary::suggestions_t words;
+        for (size_t i = 0; i < n_layers; ++i)
+            if (L[i].alive)
+                L[i].c.suggest(search, mask, ignore_hidden, words);
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+        match.insert(match.end(), words.begin(), words.end());
+    }
+
+    command *command_set::add(const std::string &cmd_str, const char *name, command::filter_t mask_, bool hidden_)
+    {
+        return add(cmd_str,name,token::ID_NOT_SET,mask_,hidden_);
+    }
+
+    command *command_set::add(const std::string &cmd_str, token::id_t ID, command::filter_t mask_, bool hidden_)
+    {
+        return add(cmd_str,NULL,ID,mask_,hidden_);
+    }
+
+    command* command_set::add(const std::string &cmd_str, const char *name, token::id_t ID, command::filter_t mask_, bool hidden_)
+    {
+        if (name != NULL || ID != token::ID_NOT_SET) {
+            // break command string into tokens
+            std::unique_ptr<token> Tadd(libchars::lexer(cmd_str));
+            if (Tadd.get() == NULL)
+                return NULL;
+            // make sure none of the tokens are quoted strings nor empty strings
+            token *T = Tadd.get();
+            while (T != NULL) {
+                if (T->status & token::IS_QUOTED)
+                    return NULL;
+                if (T->value.empty())
+                    return NULL;
+                T = T->next;
             }
-            else if (c == current_char() && (current()->mask & mask) != 0 && (!current()->hidden || ignore_hidden)) {
-                ++si;
-                ++idx;
-                w += c;
+            // build sanitized version of command string
+            T = Tadd.get();
+            std::string cmd_str_sanitized(T->value);
+            T = T->next;
+            while (T != NULL) {
+                cmd_str_sanitized += ' ';
+                cmd_str_sanitized.append(T->value);
+                T = T->next;
             }
-            else if (idx == 0) {
-                if (S.empty()) {
-                    return false;
+            // add command to internal list
+            adopt();
+            ++version;
+            command *c_new = new command(cmd_str_sanitized, name, mask_, ID, hidden_);
+            LC_LOG_VERBOSE("set[%p] command[%s] = %p",this,cmd_str_sanitized.c_str(),c_new);
+            if (C_list != NULL)
+                c_new->next = C_list;
+            C_list = c_new;
+            if (!stale) {
+                command_dictionary &D = writable();
+                D.insert(c_new);
+                stale = D.fragmented();
+            }
+            return c_new;
+        }
+        return NULL;
+    }
+
+    bool command_set::add(const command_def *defs, size_t n)
+    {
+        bool ok = true;
+        for (size_t i = 0; i < n; ++i) {
+            const command_def &D = defs[i];
+            command *c = add(D.cmd_str, D.name, D.ID, D.mask, D.hidden);
+            if (c == NULL) {
+                LC_LOG_VERBOSE("set[%p] command[%s] not added",this,D.cmd_str);
+                ok = false;
+                continue;
+            }
+            c->set_help(D.help);
+            for (size_t k = 0; k < D.n_par; ++k) {
+                const parameter_def &P = D.par[k];
+                parameter *p;
+                switch (P.ttype) {
+                case token::FLAG:
+                    p = c->add(parameter(P.ID, P.name));
+                    break;
+                case token::KEY:
+                    p = c->add(parameter(P.ID, P.name, P.vtype));
+                    break;
+                default:
+                    p = c->add(parameter(P.ID, P.vtype));
                 }
-                command_node *n = S.top()->next;
-                if (n != NULL) {
-                    S.pop();
-                    S.push(n);
-                    idx = 0;
+                p->status = (p->status & ~(token::MANDATORY | token::HIDDEN)) | (P.status & (token::MANDATORY | token::HIDDEN));
+                p->set_help(P.help);
+                p->set_default(P.value);
+            }
+        }
+        return ok;
+    }
+
+    bool command_set::remove(command *cmd)
+    {
+        adopt();
+        command **C = &C_list;
+        while (*C != NULL && *C != cmd)
+            C = &(*C)->next;
+        if (*C == NULL)
+            return false;
+
+        LC_LOG_VERBOSE("set[%p] remove command[%s] = %p",this,cmd->cmd_str.c_str(),cmd);
+        *C = cmd->next;
+        if (!stale) {
+            command_dictionary &D = writable();
+            D.remove(cmd);
+            stale = D.fragmented();
+        }
+        ++version;
+        cmd->next = NULL;
+        retire(cmd);
+        return true;
+    }
+
+    bool command_set::save(const char *path, uint64_t hash)
+    {
+        return build().save(path, hash);
+    }
+
+    bool command_set::load(const char *path, uint64_t hash)
+    {
+        command_dictionary *D = fresh();
+        if (!replace(D, D->load(path, hash)))
+            return false;
+        // commands are created from the snapshot when used
+        retire(C_list);
+        C_list = NULL;
+        stale = false;
+        ++version;
+        return true;
+    }
+
+    bool command_set::save_source(const char *path, const char *symbol, uint64_t hash)
+    {
+        return build().save_source(path, symbol, hash);
+    }
+
+    bool command_set::load(const void *image, size_t size, uint64_t hash)
+    {
+        command_dictionary *D = fresh();
+        if (!replace(D, D->load(image, size, hash)))
+            return false;
+        retire(C_list);
+        C_list = NULL;
+        stale = false;
+        ++version;
+        return true;
+    }
+
+    bool command_set::publish(const char *name, uint64_t hash)
+    {
+        return build().publish(name, hash);
+    }
+
+    bool command_set::attach(const char *name, uint64_t hash)
+    {
+        command_dictionary *D = fresh();
+        if (!replace(D, D->attach(name, hash)))
+            return false;
+        retire(C_list);
+        C_list = NULL;
+        stale = false;
+        ++version;
+        return true;
+    }
+
+    bool command_set::refresh()
+    {
+        if (!dictionary->outdated())
+            return false;
+        command_dictionary *D = fresh();
+        if (!replace(D, dictionary->reattach(*D)))
+            return false;
+        LC_LOG_VERBOSE("set[%p] switched to new catalog",this);
+        ++version;
+        return true;
+    }
+
+    void command_set::adopt()
+    {
+        if (dictionary->mapped()) {
+            if (published)
+                writable(); // copy gets its own commands
+            else
+                dictionary->thaw();
+            for (command_dictionary::index_t c = dictionary->n_commands(); c-- > 0; ) {
+                command *cmd = dictionary->command_at(c);
+                cmd->next = C_list;
+                C_list = cmd;
+            }
+        }
+    }
+
+    command_dictionary &command_set::writable(bool keep)
+    {
+        // a published dictionary may be in use by sessions: changes go to a
+        // new one, the published one is reclaimed by the catalog
+        if (published) {
+            command_dictionary *D = new command_dictionary;
+            if (keep)
+                D->copy(*dictionary);
+            r_dictionaries.push_back(dictionary);
+            dictionary = D;
+            published = false;
+        }
+        return *dictionary;
+    }
+
+    bool command_set::replace(command_dictionary *D, bool ok)
+    {
+        // 'D' (see fresh()) was loaded: it becomes the dictionary of the set
+        // and a published one is retired; if not loaded, it is dropped
+        if (D != dictionary) {
+            if (!ok) {
+                delete D;
+                return false;
+            }
+            r_dictionaries.push_back(dictionary);
+            dictionary = D;
+            published = false;
+        }
+        if (ok)
+            fold = dictionary->case_insensitive(); // as saved
+        return ok;
+    }
+
+    void command_set::retire(command *cmd)
+    {
+        if (cmd == NULL)
+            return;
+        if (shared)
+            r_commands.push_back(cmd);
+        else
+            delete cmd;
+    }
+
+    void command_set::ignore_case(bool on)
+    {
+        if (on == fold)
+            return;
+        adopt();
+        fold = on;
+        stale = true;
+        ++version;
+    }
+
+    const command_dictionary &command_set::build()
+    {
+        if (stale) {
+            std::vector<command*> C_all;
+            for (command *c = C_list; c != NULL; c = c->next)
+                C_all.push_back(c);
+            writable(false).build(C_all, fold);
+            stale = false;
+        }
+        return *dictionary;
+    }
+
+    command_set::~command_set()
+    {
+        delete C_list;
+        delete dictionary;
+        for (size_t i = 0; i < r_dictionaries.size(); ++i)
+            delete r_dictionaries[i];
+        for (size_t i = 0; i < r_commands.size(); ++i)
+            delete r_commands[i];
+    }
+
+    struct command_catalog::reader
+    {
+        const static uint64_t IDLE = (uint64_t)-1;
+
+        uint64_t epoch; // IDLE if no view pinned
+        int used; // entry taken by a session
+        reader *next;
+    };
+
+    command_catalog::command_catalog(bool concurrent_) :
+        concurrent(concurrent_),current(new command_view),epoch(0),committed(0),readers(NULL)
+    {
+        C_set_default.shared = concurrent;
+        current->epoch = epoch;
+    }
+
+    command_catalog::~command_catalog()
+    {
+        // sessions must be gone
+        for (size_t i = 0; i < retired.size(); ++i) {
+            delete retired[i].view;
+            delete retired[i].dictionary;
+            delete retired[i].cmd;
+        }
+        delete current;
+        while (readers != NULL) {
+            reader *r = readers;
+            readers = r->next;
+            delete r;
+        }
+    }
+
+    command_set &command_catalog::cset(const std::string &set_name)
+    {
+        if (set_name.empty())
+            return cset();
+        command_set &C_set = C_sets[set_name];
+        C_set.shared = concurrent;
+        return C_set;
+    }
+
+    bool command_catalog::cset_exists(const std::string &set_name) const
+    {
+        return (!set_name.empty() && C_sets.find(set_name) != C_sets.end());
+    }
+
+    command_set &command_catalog::cset()
+    {
+        C_set_default.activate(); // will stay activated after this point
+        return C_set_default;
+    }
+
+    void command_catalog::deactivate_all_sets()
+    {
+        //NOTE: C_set_default not deactivated
+        command_sets_t::iterator csi = C_sets.begin();
+        while (csi != C_sets.end()) {
+            command_set &C_set = csi->second;
+            C_set.deactivate();
+            ++csi;
+        }
+    }
+
+    uint64_t command_catalog::version() const
+    {
+        // set versions only ever increase, so their sum changes on any change
+        uint64_t v = C_sets.size() + C_set_default.version;
+        command_sets_t::const_iterator csi = C_sets.begin();
+        while (csi != C_sets.end()) {
+            v += csi->second.version;
+            ++csi;
+        }
+        return v;
+    }
+
+    bool command_catalog::refresh()
+    {
+        bool switched = C_set_default.refresh();
+        command_sets_t::iterator csi = C_sets.begin();
+        while (csi != C_sets.end()) {
+            if (csi->second.refresh()) switched = true;
+            ++csi;
+        }
+        return switched;
+    }
+
+    void command_catalog::commit()
+    {
+        uint64_t v = version();
+        if (v != committed) {
+            // new view, built off to the side; sessions still use the current one
+            command_view *V = new command_view;
+            V->epoch = epoch + 1;
+            if (C_set_default.active && !C_set_default.empty()) {
+                V->overlay.push_back(&C_set_default.build());
+                C_set_default.published = concurrent;
+            }
+            command_sets_t::iterator csi = C_sets.begin();
+            while (csi != C_sets.end()) {
+                command_set &C_set = csi->second;
+                if (C_set.active && !C_set.empty() && V->overlay.size() == command_cursor::MAX_LAYERS) {
+                    LC_LOG_ERROR("set[%s] not searched; more than %zu active sets",csi->first.c_str(),command_cursor::MAX_LAYERS);
                 }
-                else {
-                    return false;
+                else if (C_set.active && !C_set.empty()) {
+                    LC_LOG_VERBOSE("set[%s]",csi->first.c_str());
+                    V->overlay.push_back(&C_set.build());
+                    C_set.published = concurrent;
                 }
+                ++csi;
+            }
+
+            // swap: view first, then epoch (see pin())
+            command_view *V_old = current;
+            __atomic_store_n(&current, V, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&epoch, V->epoch, __ATOMIC_SEQ_CST);
+            committed = v;
+
+            retired_t R = { V->epoch, V_old, NULL, NULL };
+            retired.push_back(R);
+            retire(C_set_default, V->epoch);
+            for (csi = C_sets.begin(); csi != C_sets.end(); ++csi)
+                retire(csi->second, V->epoch);
+        }
+        reclaim();
+    }
+
+    void command_catalog::retire(command_set &C_set, uint64_t e)
+    {
+        for (size_t i = 0; i < C_set.r_dictionaries.size(); ++i) {
+            retired_t R = { e, NULL, C_set.r_dictionaries[i], NULL };
+            retired.push_back(R);
+        }
+        for (size_t i = 0; i < C_set.r_commands.size(); ++i) {
+            retired_t R = { e, NULL, NULL, C_set.r_commands[i] };
+            retired.push_back(R);
+        }
+        C_set.r_dictionaries.clear();
+        C_set.r_commands.clear();
+    }
+
+    void command_catalog::reclaim()
+    {
+        // oldest epoch still announced by a session; anything retired at or
+        // before it is no longer reachable from views in use
+        uint64_t oldest = reader::IDLE;
+        for (reader *r = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+            uint64_t e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+            if (e < oldest)
+                oldest = e;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < retired.size(); ++i) {
+            if (retired[i].epoch <= oldest) {
+                delete retired[i].view;
+                delete retired[i].dictionary;
+                delete retired[i].cmd;
             }
             else {
-                return false;
+                retired[n++] = retired[i];
             }
         }
-
-        return (current() != NULL && si >= search.length() && (current()->mask & mask) != 0 && (!current()->hidden || ignore_hidden));
+        retired.resize(n);
     }
 
-    command *command_set::add(const std::string &cmd_str, const char *name, command::filter_t mask_, bool hidden_)
+    command_catalog::reader *command_catalog::join()
     {
-        return add(cmd_str,name,token::ID_NOT_SET,mask_,hidden_);
+        reader *r;
+        for (r = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+            int unused = 0;
+            if (__atomic_compare_exchange_n(&r->used, &unused, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                return r;
+        }
+        r = new reader;
+        r->epoch = reader::IDLE;
+        r->used = 1;
+        r->next = __atomic_load_n(&readers, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&readers, &r->next, r, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) ;
+        return r;
     }
 
-    command *command_set::add(const std::string &cmd_str, token::id_t ID, command::filter_t mask_, bool hidden_)
+    void command_catalog::leave(reader *r)
     {
-        return add(cmd_str,NULL,ID,mask_,hidden_);
+        __atomic_store_n(&r->epoch, reader::IDLE, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
     }
 
-    command* command_set::add(const std::string &cmd_str, const char *name, token::id_t ID, command::filter_t mask_, bool hidden_)
+    const command_view *command_catalog::pin(reader *r)
     {
-        if (name != NULL || ID != token::ID_NOT_SET) {
-            // break command string into tokens
-            std::unique_ptr<token> Tadd(libchars::lexer(cmd_str));
-            if (Tadd.get() == NULL)
-                return NULL;
-            // make sure none of the tokens are quoted strings nor empty strings
-            token *T = Tadd.get();
-            while (T != NULL) {
-                if (T->status & token::IS_QUOTED)
-                    return NULL;
-                if (T->value.empty())
-                    return NULL;
-                T = T->next;
-            }
-            // build sanitized version of command string
-            T = Tadd.get();
-            std::string cmd_str_sanitized(T->value);
-            T = T->next;
-            while (T != NULL) {
-                cmd_str_sanitized += ' ';
-                cmd_str_sanitized.append(T->value);
-                T = T->next;
-            }
-            // add command to internal list
-            dirty = true;
-            command *c_new = new command(cmd_str_sanitized, name, mask_, ID, hidden_);
-            LC_LOG_VERBOSE("set[%p] command[%s] = %p",this,cmd_str_sanitized.c_str(),c_new);
-            if (C_list != NULL)
-                c_new->next = C_list;
-            C_list = c_new;
-            return c_new;
-        }
-        return NULL;
+        // announce the epoch before reading the view: a view read afterwards
+        // is at least as new, and commit() cannot have missed the announcement
+        // if the epoch did not move on in between
+        uint64_t e;
+        do {
+            e = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&r->epoch, e, __ATOMIC_SEQ_CST);
+        } while (__atomic_load_n(&epoch, __ATOMIC_SEQ_CST) != e);
+        return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
     }
 
     command::command(const std::string &cmd_str_, const char *name_, filter_t mask_, token::id_t ID_, bool hidden_) :
-        ID(ID_),cmd_str(cmd_str_),mask(mask_),hidden(hidden_),next(NULL)
+        ID(ID_),cmd_str(cmd_str_),mask(mask_),hidden(hidden_),next(NULL),names_(NULL)
     {
         if (name_ != NULL)
             name.assign(name_);
     }
 
+    command::~command()
+    {
+        delete next;
+        delete names_;
+    }
+
     void command::set_help(const char *help_)
     {
         if (help_ != NULL)
@@ -567,9 +1323,27 @@ namespace libchars {
     parameter* command::add(const parameter &par_)
     {
         par.push_back(par_);
+        // names rebuilt on next use (parameters are added before sessions run)
+        delete names_;
+        names_ = NULL;
         return &par.back();
     }
 
+    const parameter_names &command::names() const
+    {
+        // commands are shared by sessions: the first names published win
+        // (as command_dictionary::materialize())
+        parameter_names *N = __atomic_load_n(&names_, __ATOMIC_ACQUIRE);
+        if (N == NULL) {
+            parameter_names *built = new parameter_names(par);
+            if (__atomic_compare_exchange_n(&names_, &N, built, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                N = built;
+            else
+                delete built;
+        }
+        return *N;
+    }
+
     enum lex_inputs {
         X_WS  = 0, // input: whitespace
         X_A0  = 1, // input: printable
@@ -605,6 +1379,21 @@ namespace libchars {
         /* S_EOL */ {  S_EOL, S_EOL, S_EOL, S_EOL, S_EOL, },
     };
 
+    static inline lex_inputs lex_input(char c)
+    {
+        if (c == 0)
+            return X_EOL;
+        else if (c == '\\')
+            return X_ESC;
+        else if (c == '"')
+            return X_Q;
+        else if (isspace(c) || c == '=')
+            return X_WS;
+        else if (isprint(c))
+            return X_A0;
+        return X_WS;
+    }
+
     token *lexer(const std::string &str)
     {
         token *t_tail = NULL;
@@ -613,17 +1402,7 @@ namespace libchars {
         uint32_t state = S_WS;
         do {
             char c = (offset < str.length()) ? str.at(offset) : 0;
-            lex_inputs x = X_WS;
-            if (c == 0)
-                x = X_EOL;
-            else if (c == '\\')
-                x = X_ESC;
-            else if (c == '"')
-                x = X_Q;
-            else if (isspace(c) || c == '=')
-                x = X_WS;
-            else if (isprint(c))
-                x = X_A0;
+            lex_inputs x = lex_input(c);
 
             uint32_t tr = lex_transitions[state][x];
             if ((tr & (A_PUSH|A_EOTP)) != 0) {
@@ -660,16 +1439,22 @@ namespace libchars {
     }
 
 
-    commands::commands(terminal_driver &d) :
+    commands::commands(terminal_driver &d, command_catalog *shared) :
         edit_object(libchars::MODE_COMMAND),
-        edit(d),mask(0),
+        edit(d),
+        C_catalog(shared != NULL ? shared : new command_catalog(false)),C_owned(shared == NULL),
+        C_reader(C_catalog->join()),overlay_epoch((uint64_t)-1),mask(0),
         remember(NULL),status(EMPTY),dirty(true),
-        t_cmd(NULL), t_par(NULL),cmd(NULL),
-        timeout(0) {}
+        lex_all(true),lex_start(std::string::npos),lex_end(0),lex_old_end(0),
+        t_cmd(NULL),t_par(NULL),t_last(NULL),cmd(NULL),
+        timeout(0),abbreviate(false),tab_limit(40) {}
 
     commands::~commands()
     {
         delete t_cmd;
+        C_catalog->leave(C_reader);
+        if (C_owned)
+            delete C_catalog;
     }
 
     const std::string commands::value() const
@@ -680,11 +1465,148 @@ namespace libchars {
         return str;
     }
 
+    void commands::damage(size_t offset, size_t removed, size_t added)
+    {
+        // merge edit [offset,offset+removed) -> [offset,offset+added) into the
+        // region that has to be re-lexed; lex_start..lex_end is in current
+        // buffer coordinates, lex_start..lex_old_end in token coordinates
+        if (lex_start == std::string::npos) {
+            lex_start = offset;
+            lex_end = offset + added;
+            lex_old_end = offset + removed;
+        }
+        else {
+            size_t end = std::max(lex_end, offset + removed);
+            lex_old_end += end - lex_end;
+            lex_end = end + added - removed;
+            lex_start = std::min(lex_start, offset);
+        }
+    }
+
+    static void lex_reset(token *T)
+    {
+        // undo annotations of a previous parse (token is re-used as lexed)
+        if (T->ttype == token::FLAG || (T->ttype == token::KEY && !(T->status & token::IS_VALUE)))
+            T->value = T->name; // sort() clears value after full match on name
+        T->status &= (token::IN_STRING | token::IS_QUOTED);
+        T->ttype = token::UNKNOWN;
+        T->name.clear();
+        T->ID = token::ID_NOT_SET;
+        T->vtype = validator::NONE;
+    }
+
     void commands::lexer()
     {
-        delete t_cmd;
         t_par = NULL;
-        t_cmd = libchars::lexer(value());
+
+        if (lex_all) {
+            delete t_cmd;
+            t_cmd = t_last = NULL;
+            lex_all = false;
+            lex_start = 0;
+            lex_end = lex_old_end = length();
+        }
+        else {
+            // drop default-value tokens appended by sort(); re-use the rest
+            if (t_last != NULL) {
+                delete t_last->next;
+                t_last->next = NULL;
+            }
+            for (token *T = t_cmd; T != NULL; T = T->next)
+                lex_reset(T);
+        }
+
+        if (lex_start == std::string::npos)
+            return; // only the dictionary or mask changed
+
+        // tokens ending (at least one separator) before the edit are not affected;
+        // lexing restarts after the last one of them in whitespace state
+        token *R = NULL;
+        token *O = t_cmd;
+        while (O != NULL && (O->offset + O->length) < lex_start) {
+            R = O;
+            O = O->next;
+        }
+        token *O_first = O, *O_prev = R;
+
+        token *t_head = NULL, *t_tail = NULL;
+        const size_t L = length();
+        size_t offset = (R != NULL) ? (R->offset + R->length) : 0;
+        size_t offset_start = offset;
+        uint32_t state = S_WS;
+        bool synced = false;
+        do {
+            char c = (offset < L) ? at(offset) : 0;
+            lex_inputs x = lex_input(c);
+
+            uint32_t tr = lex_transitions[state][x];
+            if ((tr & (A_EOT|A_EOTP)) != 0) {
+                // end of token (if not empty)
+                if (offset > offset_start && offset_start < L) {
+                    token *T = new token;
+                    T->status = token::IN_STRING;
+                    if (state == S_STR || state == S_E2)
+                        T->status |= token::IS_QUOTED;
+                    T->offset = offset_start;
+                    T->length = offset - offset_start;
+                    if (tr & A_EOTP) ++T->length;
+                    T->value.reserve(T->length);
+                    for (size_t i = T->offset; i < (T->offset + T->length); ++i)
+                        T->value += at(i);
+                    if (t_head == NULL)
+                        t_head = T;
+                    else
+                        t_tail->next = T;
+                    t_tail = T;
+                }
+            }
+            if ((tr & A_SOT) != 0) {
+                // new token
+                offset_start = offset;
+            }
+            state = tr & 0x0f;
+
+            if (state == S_WS && x == X_WS && offset >= lex_end) {
+                // unchanged whitespace beyond the edit; if it was also outside a
+                // token before the edit, the rest of the old tokens still apply
+                size_t old_offset = offset - lex_end + lex_old_end;
+                while (O != NULL && (O->offset + O->length) <= old_offset) {
+                    O_prev = O;
+                    O = O->next;
+                }
+                if (O == NULL || O->offset > old_offset) {
+                    synced = true;
+                    break;
+                }
+            }
+        } while (offset++ < L);
+
+        // replace affected tokens [O_first,O) with newly lexed tokens
+        if (!synced) {
+            delete O_first;
+            O = NULL;
+        }
+        else if (O != O_first) {
+            O_prev->next = NULL;
+            delete O_first;
+        }
+        t_last = (t_tail != NULL) ? t_tail : R;
+        if (t_tail != NULL)
+            t_tail->next = O;
+        else
+            t_head = O;
+        if (R != NULL)
+            R->next = t_head;
+        else
+            t_cmd = t_head;
+
+        // shift offsets of tokens after the edit
+        for (; O != NULL; O = O->next) {
+            O->offset = O->offset - lex_old_end + lex_end;
+            t_last = O;
+        }
+
+        lex_start = std::string::npos;
     }
 
     size_t commands::render(size_t buf_idx, size_t limit, std::string &sequence)
@@ -761,7 +1683,7 @@ namespace libchars {
             t_par = NULL;
             token *T = t_cmd;
             token *Tcmd = NULL;
-            command_cursor ci(&root);
+            command_cursor ci(overlay);
             while (T != NULL) {
                 if (T->status & token::IS_QUOTED || T->value.empty() || !ci.find(T->value,mask,true)) {
                     if (Tcmd == NULL)
@@ -770,10 +1692,12 @@ namespace libchars {
                 }
                 T->ttype = token::COMMAND;
                 status = PARTIAL_COMMAND;
+                if (abbreviate && !(ci.end() && (ci.command(mask,true) || ci.subword(mask,true))))
+                    ci.expand(mask); // hidden commands are never abbreviated
                 if (!ci.end())
                     break;
                 if (ci.command(mask,true)) {
-                    cmd = ci.current()->get();
+                    cmd = ci.get(mask,true);
                     Tcmd = T;
                     // continue search in case a longer match is found
                 }
@@ -926,6 +1850,21 @@ namespace libchars {
         }
     }
 
+    static const char *group_digits(size_t n, char *buf, size_t size)
+    {
+        // 99873 --> "99,873"
+        char digits[24];
+        int d = snprintf(digits, sizeof(digits), "%zu", n);
+        size_t o = 0;
+        for (int i = 0; i < d && (o + 2) < size; ++i) {
+            if (i > 0 && ((d - i) % 3) == 0)
+                buf[o++] = ',';
+            buf[o++] = digits[i];
+        }
+        buf[o] = 0;
+        return buf;
+    }
+
     void commands::auto_complete()
     {
         LC_LOG_VERBOSE("complete@%zu/%zu",insert_idx,length());
@@ -944,139 +1883,301 @@ namespace libchars {
                 LC_LOG_VERBOSE("** no current token **");
             }
 
-            std::string available_str;
-            token *T = t_cmd;
-            while (T != NULL && T->length > 0) {
-                if (T == Tcur) {
-                    if (t_offset < Tcur->length) {
-                        available_str.append(T->value, 0, t_offset);
-                    }
-                    else {
-                        available_str.append(T->value);
-                    }
-                    break;
-                }
-                else {
-                    available_str.append(T->value);
-                    available_str += ' ';
-                }
-                T = T->next;
-            }
-
-            // find current position in command dictionary
-            command_cursor ci(&root);
-            T = t_cmd;
-            bool available = true;
-            while (T != NULL && ci.valid() && available) {
-                LC_LOG_VERBOSE("search token [%p/%s@%zu+%zu]",T,T->value.c_str(),T->offset,T->length);
-                if (T == Tcur) {
-                    if (t_offset > 0) {
-                        std::string v_search = T->value.substr(0,t_offset);
-                        LC_LOG_VERBOSE("offset[%zu]; search for [%s]",t_offset,v_search.c_str());
-                        available = ci.find(v_search,mask);
+            // find current position in command dictionary; kept from the last
+            // TAB while the line is unchanged (the words found are listed with
+            // the options in their dictionary spelling)
+            if (!tab.valid || tab.epoch != overlay_epoch || tab.mask != mask ||
+                tab.line.length() != length() || (length() > 0 && memcmp(tab.line.data(), data(), length()) != 0)) {
+                tab.valid = false;
+                tab.spelled.clear();
+                tab.at = command_cursor(overlay);
+                command_cursor &ci = tab.at;
+                word_buffer word;
+                token *T = t_cmd;
+                bool available = true;
+                while (T != NULL && ci.valid() && available) {
+                    LC_LOG_VERBOSE("search token [%p/%s@%zu+%zu]",T,T->value.c_str(),T->offset,T->length);
+                    if (T == Tcur) {
+                        if (t_offset > 0) {
+                            LC_LOG_VERBOSE("offset[%zu]; search for [%.*s]",t_offset,(int)t_offset,T->value.c_str());
+                            available = ci.find(T->value.data(),t_offset,mask);
+                        }
+                        else {
+                            available = false;
+                        }
+                        T = NULL;
                     }
                     else {
-                        available = false;
+                        available = ci.find(T->value,mask) && (!abbreviate || ci.expand(mask));
+                        if (available) {
+                            ci.word(word);
+                            tab.spelled.append(word.str(), word.length());
+                            tab.spelled += ' ';
+                            available = ci.next_root();
+                        }
+                        T = T->next;
                     }
-                    T = NULL;
-                }
-                else {
-                    available = ci.find(T->value,mask);
-                    available = available && ci.next_root();
-                    T = T->next;
                 }
-            }
-
-            LC_LOG_DEBUG("cursor: %p @ %zu: [%s]", ci.current(), ci.current_idx(), ci.word().c_str());
-            if (ci.valid())
-                LC_LOG_VERBOSE("dictionary option: [%s]",ci.current()->part.c_str());
-
-            if (!available) {
-                LC_LOG_DEBUG("** no options available **");
-                return;
-            }
-
-            // collect combinations (full words + words with sub-words + words with valid commands)
-            typedef std::list<std::string> string_list_t;
-            string_list_t options;
-            bool is_command = false;
-            LC_LOG_VERBOSE("current partial word: [%s]",ci.word().c_str());
-            command_cursor cw(ci);
-            while (cw.next()) {
-                if (!cw.word().empty() && cw.end() && (cw.command(mask) || cw.subword(mask))) {
-                    LC_LOG_VERBOSE("options += %s[%s]", ci.word().c_str(), cw.word().c_str());
-                    options.push_back(cw.word());
-                    is_command = cw.command(mask);
+                if (!available) {
+                    LC_LOG_DEBUG("** no options available **");
+                    complete_parameter(Tcur, t_offset);
+                    return;
                 }
+                tab.line.assign(data(), length());
+                tab.epoch = overlay_epoch;
+                tab.mask = mask;
+                tab.valid = true;
             }
-            if (!options.empty() && ci.end() && (ci.command(mask) || ci.subword(mask))) {
-                LC_LOG_VERBOSE("options += <cr>");
-                options.push_back("");
-            }
-
-            if (options.empty()) {
-                if (!ci.word().empty() && ci.end()) {
+            command_cursor &ci = tab.at;
+            word_buffer word; // at cursor
+            size_t w_length = ci.word(word);
+            LC_LOG_DEBUG("cursor: [%s]%s", word.str(), ci.end()?" (end)":"");
+
+            // options: full words + words with sub-words + words with valid
+            // commands that extend the current word, and the current word
+            // itself (<cr>) if there are any; answered from the summaries of
+            // the dictionaries, so that the options are only walked to be listed
+            command_cursor common;
+            bool exact;
+            size_t n = ci.complete(mask,common,exact);
+            bool cr = (n > 0 && ci.end() && (ci.command(mask) || ci.subword(mask)));
+            LC_LOG_VERBOSE("current partial word: [%s]; %zu option(s)%s",word.str(),n,cr?" + <cr>":"");
+
+            word_buffer extension; // common part of options
+            size_t e_length = common.word(extension);
+            e_length = (cr || e_length < w_length) ? 0 : (e_length - w_length);
+
+            if (n == 0) {
+                if (w_length > 0 && ci.end()) {
                     // end-of-word --> add space
                     LC_LOG_DEBUG("insert space");
                     insert(' ');
                     // no need to reparse because whitespace does not change token list
+                    tab.spelled.append(word.str(), w_length);
+                    tab.spelled += ' ';
+                    tab.valid = ci.next_root();
+                    tab.line.assign(data(), length());
                 }
                 else {
+                    complete_parameter(Tcur, t_offset);
                     return;
                 }
             }
-            else if (options.size() == 1) {
-                // middle-of-word --> complete word (take first option)
+            else if (n == 1 && !cr) {
+                // middle-of-word --> complete word
                 // line empty / after whitespace + 1 path --> add word
-                LC_LOG_DEBUG("insert(middle/empty) [%s]",options.front().c_str());
-                const std::string &word_to_insert = options.front();
-                size_t i = 0;
-                while (i < word_to_insert.size())
-                    insert(word_to_insert.at(i++));
+                LC_LOG_DEBUG("insert(middle/empty) [%.*s]",(int)e_length,extension.str() + w_length);
+                for (size_t i = 0; i < e_length; ++i)
+                    insert(extension.str()[w_length + i]);
+                tab.at = common;
+                tab.line.assign(data(), length());
                 // reparse before next iteration of loop
                 parse();
                 // stop auto-complete if new string is a valid command
-                if (is_command)
+                if (common.command(mask))
                     return;
             }
             else {
-                // 2+ options --> find longest common prefix amongst options
-                std::string prefix = options.front();
-                string_list_t::const_iterator si = options.begin();
-                ++si;
-                while (!prefix.empty() && si != options.end()) {
-                    const std::string &cmp_str = *si++;
-                    if (cmp_str.length() < prefix.length())
-                        prefix = prefix.substr(0,cmp_str.length());
-                    while (!prefix.empty() && cmp_str.compare(0,prefix.length(),prefix) != 0)
-                        prefix.erase(prefix.length() - 1);
-                }
-
-                if (!prefix.empty()) {
+                if (e_length > 0) {
                     // common prefix available --> add prefix
-                    size_t i = 0;
-                    while (i < prefix.size())
-                        insert(prefix.at(i++));
+                    for (size_t i = 0; i < e_length; ++i)
+                        insert(extension.str()[w_length + i]);
+                    tab.at = common;
+                    tab.line.assign(data(), length());
                     // reparse before next iteration of loop
                     parse();
                 }
                 else {
-                    // dump available options
-                    printf("\n");
-                    string_list_t::const_iterator si = options.begin();
-                    while (si != options.end()) {
-                        printf("%s%s%s%s%s\n",
-                            color_str(COLOR_NORMAL),
-                            available_str.c_str(),
-                            color_str(COLOR_COMPLETION),
-                            (si++)->c_str(),
-                            color_str(COLOR_NORMAL));
+                    // show the options in a menu below the line, one page at
+                    // a time; a page is only walked when it is shown
+                    menu.names.clear();
+                    menu.pages.resize(1);
+                    menu.pages[0] = command_cursor(ci);
+                    menu.first.assign(1, 0);
+                    menu.before = tab.spelled;
+                    menu.word.assign(word.str(), w_length);
+                    menu.n = n;
+                    menu.exact = exact;
+                    menu.cr = cr;
+                    show_menu(0, std::string::npos);
+                }
+                return;
+            }
+        }
+    }
+
+    bool commands::next_option(command_cursor &cw) const
+    {
+        // options: complete words that are commands or have sub-words
+        while (cw.next(mask,false)) {
+            if (cw.word_length() > 0 && cw.end() && (cw.command(mask) || cw.subword(mask)))
+                return true;
+        }
+        return false;
+    }
+
+    void commands::show_menu(size_t page, size_t selected)
+    {
+        // header: words before the current one (common to all options)
+        std::string header;
+        if (!menu.before.empty()) {
+            header.append(color_str(COLOR_NORMAL));
+            header.append(menu.before);
+        }
+        size_t lines = (header.empty() ? 0 : 1) + 1; // + footer
+        bool printed = (edit.menu_capacity(1, lines) == std::string::npos);
+
+        // walk the options of the page from its first one (or take them
+        // from the list); the page is full when the next option does not
+        // fit next to the others
+        command_cursor cw;
+        if (menu.names.empty())
+            cw = menu.pages[page];
+        bool on_option = (page > 0);
+        word_buffer option;
+        size_t width = 0;
+        size_t k = menu.first[page]; // next option (list)
+        menu.options.clear();
+        menu.more = false;
+        if (page == 0 && menu.cr) {
+            menu.options.push_back(menu.word);
+            width = menu.word.length();
+        }
+        while (true) {
+            std::string text;
+            if (!menu.names.empty()) {
+                if (k >= menu.names.size())
+                    break;
+                text = menu.names[k];
+            }
+            else {
+                if (!on_option && !next_option(cw))
+                    break;
+                on_option = false;
+                cw.word(option);
+                text = menu.word + option.str();
+            }
+            size_t w = std::max(width, text.length());
+            size_t fit = printed ? std::string::npos : edit.menu_capacity(w, lines);
+            if (tab_limit > 0 && fit > tab_limit)
+                fit = tab_limit;
+            if (menu.options.size() >= fit) {
+                if (menu.first.size() == page + 1) {
+                    if (menu.names.empty()) {
+                        menu.pages.push_back(command_cursor());
+                        menu.pages.back() = cw;
                     }
-                    rewind();
+                    menu.first.push_back(menu.first[page] + menu.options.size());
                 }
+                menu.more = true;
+                break;
+            }
+            menu.options.push_back(text);
+            width = w;
+            ++k;
+        }
+        menu.page = page;
+
+        // footer: position in the options (counted by the dictionaries; an
+        // upper bound if several dictionaries have words)
+        std::string footer;
+        size_t total = menu.n + (menu.cr ? 1 : 0);
+        size_t last = menu.first[page] + menu.options.size();
+        if (printed && menu.more) {
+            char count[32];
+            footer.append(color_str(COLOR_NORMAL));
+            footer.append("... and ");
+            if (!menu.exact)
+                footer.append("up to ");
+            footer.append(group_digits((total > last) ? (total - last) : 1, count, sizeof(count)));
+            footer.append(" more");
+        }
+        else if (!printed && (page > 0 || menu.more)) {
+            char from[32], to[32], count[32];
+            footer.append(color_str(COLOR_NORMAL));
+            footer.append(group_digits(menu.first[page] + 1, from, sizeof(from)));
+            footer.append("-");
+            footer.append(group_digits(last, to, sizeof(to)));
+            footer.append(" of ");
+            if (!menu.exact)
+                footer.append("up to ");
+            footer.append(group_digits(std::max(total, last), count, sizeof(count)));
+        }
+
+        if (edit.menu_show(header, menu.options, color_str(COLOR_COMPLETION), footer, selected) != 0)
+            rewind(); // printed: line follows
+    }
+
+    void commands::menu_move(key_e key)
+    {
+        // TAB/arrows move the selection (columns are filled top to bottom),
+        // page up/down show another page; the first TAB only selects
+        size_t n = menu.options.size();
+        size_t rows = edit.menu_rows();
+        size_t idx = edit.menu_selected();
+        bool none = (idx >= n);
+        size_t page = menu.page;
+        switch (key) {
+        case KEY_TAB:
+        case KEY_DOWN:
+            if (none)
+                idx = 0;
+            else if ((idx + 1) < n)
+                ++idx;
+            else {
+                // next page; after the last, back to the first
+                show_menu(menu.more ? page + 1 : 0, 0);
+                return;
+            }
+            break;
+        case KEY_UP:
+            if (none)
+                idx = 0;
+            else if (idx > 0)
+                --idx;
+            else if (page > 0) {
+                show_menu(page - 1, menu.first[page] - menu.first[page - 1] - 1);
                 return;
             }
+            break;
+        case KEY_LEFT:
+            if (none)
+                idx = 0;
+            else if (idx >= rows)
+                idx -= rows;
+            break;
+        case KEY_RIGHT:
+            if (none)
+                idx = 0;
+            else if ((idx + rows) < n)
+                idx += rows;
+            break;
+        case KEY_PGDN:
+            if (menu.more)
+                show_menu(page + 1, idx);
+            return;
+        case KEY_PGUP:
+            if (page > 0)
+                show_menu(page - 1, idx);
+            return;
+        default:
+            return;
         }
+        edit.menu_select(idx);
+    }
+
+    bool commands::menu_accept()
+    {
+        // complete the current word with the selected option
+        size_t idx = edit.menu_selected();
+        if (idx >= menu.options.size())
+            return false;
+        edit.menu_close();
+        const std::string &option = menu.options[idx];
+        for (size_t i = menu.word.length(); i < option.length(); ++i)
+            insert(option[i]);
+        parse();
+        return true;
     }
 
     void commands::show_help()
@@ -1101,8 +2202,31 @@ namespace libchars {
             show_parameters();
             break;
         case NO_COMMAND:
-            // invalid command --> cannot show help
+            // invalid command --> cannot show help; suggest corrections for
+            // the first word that does not match
             printf("No known commands match current line\n");
+            {
+                command_cursor ci(overlay);
+                token *T = t_cmd;
+                while (T != NULL && !(T->status & token::IS_QUOTED)) {
+                    command_cursor at(ci);
+                    if (ci.find(T->value,mask,true) && (!abbreviate || ci.expand(mask)) && ci.end() &&
+                        (ci.command(mask,true) || ci.subword(mask,true)) && ci.next_root()) {
+                        T = T->next;
+                        continue;
+                    }
+                    command_dictionary::suggestions_t match;
+                    at.suggest(T->value,mask,false,match);
+                    if (!match.empty()) {
+                        const std::string line = value();
+                        printf("Did you mean:\n");
+                        for (size_t m = 0; m < match.size() && m < 8; ++m)
+                            printf("  %s%s%s\n", line.substr(0,T->offset).c_str(), match[m].second.c_str(),
+                                   line.substr(T->offset + T->length).c_str());
+                    }
+                    break;
+                }
+            }
             break;
         case EMPTY:
         case PARTIAL_COMMAND:
@@ -1111,34 +2235,34 @@ namespace libchars {
                 printf("** INTERNAL ERROR: partial command **\n");
             }
             else {
-                std::string cmd_str_search;
+                // position of the typed words in the dictionaries; a partial
+                // last word matches all words it is a prefix of
+                command_cursor ci(overlay);
+                bool found = true;
                 token *T = t_cmd;
-                while (T != NULL && T->length > 0) {
+                while (found && T != NULL && T->length > 0) {
                     LC_LOG_VERBOSE("search token [%p/%s@%zu+%zu]",T,T->value.c_str(),T->offset,T->length);
-                    if (!cmd_str_search.empty())
-                        cmd_str_search += ' ';
-                    cmd_str_search.append(T->value);
-                    if (T->next == NULL && insert_idx > (T->offset + T->length))
-                        cmd_str_search += ' ';
+                    found = ci.find(T->value,mask);
+                    if (found && (T->next != NULL || insert_idx > (T->offset + T->length)))
+                        found = (!abbreviate || ci.expand(mask)) && ci.next_root();
                     T = T->next;
                 }
-                // build match list
-                typedef std::list<command*> command_list_t;
+                // build match list; only subtrees with visible commands are walked
+                typedef std::vector<command*> command_list_t;
                 command_list_t match;
+                if (found)
+                    ci.collect(mask,false,match);
                 unsigned int match_max_length = 0;
-                command_sorted_list_t::const_iterator ci = C_sorted.begin();
-                while (ci != C_sorted.end()) {
-                    command *cmd = *ci++;
-                    if ((cmd->mask & mask) != 0 && !cmd->hidden && (cmd_str_search.empty() || cmd->cmd_str.compare(0,cmd_str_search.length(),cmd_str_search) == 0)) {
-                        match.push_back(cmd);
-                        if (cmd->cmd_str.length() > match_max_length)
-                            match_max_length = cmd->cmd_str.length();
-                    }
-                }
+                for (size_t m = 0; m < match.size(); ++m)
+                    if (match[m]->cmd_str.length() > match_max_length)
+                        match_max_length = match[m]->cmd_str.length();
+                // sort by command string; first set in overlay order wins on duplicates
+                std::stable_sort(match.begin(), match.end(), command_sort_criteria());
                 // dump match list
-                command_list_t::const_iterator mi = match.begin();
-                while (mi != match.end()) {
-                    const command *cmd = *mi++;
+                for (size_t m = 0; m < match.size(); ++m) {
+                    const command *cmd = match[m];
+                    if (m > 0 && cmd->cmd_str == match[m - 1]->cmd_str)
+                        continue;
                     printf("%-*s : %s\n", match_max_length, cmd->cmd_str.c_str(), cmd->help.c_str());
                 }
             }
@@ -1221,39 +2345,14 @@ namespace libchars {
         return T;
     }
 
-    command_set &commands::cset(const std::string &set_name)
-    {
-        return (set_name.empty() ? cset() : C_sets[set_name]);
-    }
-
-    bool commands::cset_exists(const std::string &set_name)
-    {
-        return (!set_name.empty() && C_sets.find(set_name) != C_sets.end());
-    }
-
-    command_set &commands::cset()
-    {
-        C_set_default.activate(); // will stay activated after this point
-        return C_set_default;
-    }
-
-    void commands::deactivate_all_sets()
-    {
-        //NOTE: C_set_default not deactivated
-        command_sets_t::iterator csi = C_sets.begin();
-        while (csi != C_sets.end()) {
-            command_set &C_set = csi->second;
-            C_set.deactivate();
-            ++csi;
-        }
-    }
-
     void commands::dump_dictionary()
     {
         if (LC_LOG_CHECK_LEVEL(debug::DEBUG)) {
             build_commands();
-            LC_LOG_DEBUG("Command dictionary tree:");
-            root.dump();
+            for (size_t d = 0; d < overlay.size(); ++d) {
+                LC_LOG_DEBUG("Command dictionary tree (%zu/%zu):",d+1,overlay.size());
+                overlay[d]->dump();
+            }
         }
     }
 
@@ -1261,10 +2360,11 @@ namespace libchars {
     {
         if (LC_LOG_CHECK_LEVEL(debug::DEBUG)) {
             build_commands();
-            command_sorted_list_t::const_iterator ci = C_sorted.begin();
-            while (ci != C_sorted.end()) {
-                command *cmd = *ci++;
-                LC_LOG_DEBUG("[0x%08x/%s/%p] %s",cmd->mask,cmd->hidden?"HIDDEN":"VISIBLE",cmd,cmd->cmd_str.c_str());
+            for (size_t d = 0; d < overlay.size(); ++d) {
+                for (command_dictionary::index_t c = 0; c < overlay[d]->n_commands(); ++c) {
+                    command *cmd = overlay[d]->command_at(c);
+                    LC_LOG_DEBUG("[0x%08x/%s/%p] %s",cmd->mask,cmd->hidden?"HIDDEN":"VISIBLE",cmd,cmd->cmd_str.c_str());
+                }
             }
         }
     }
@@ -1311,65 +2411,55 @@ namespace libchars {
         }
     }
 
+    bool commands::check_tokens()
+    {
+        // bring the kept tokens up to date (undoes the annotations of sort())
+        // and compare them with a full lex of the line
+        lexer();
+        dirty = true;
+
+        std::unique_ptr<token> t_full(libchars::lexer(value()));
+        const token *A = t_cmd, *B = t_full.get(), *A_last = NULL;
+        while (A != NULL && B != NULL) {
+            if (A->offset != B->offset || A->length != B->length || A->value != B->value || A->status != B->status) {
+                LC_LOG_ERROR("token [%s@%zu+%zu] != [%s@%zu+%zu]",A->value.c_str(),A->offset,A->length,B->value.c_str(),B->offset,B->length);
+                return false;
+            }
+            A_last = A;
+            A = A->next;
+            B = B->next;
+        }
+        if (A != NULL || B != NULL || t_last != A_last) {
+            LC_LOG_ERROR("token list length or last token differs");
+            return false;
+        }
+        return true;
+    }
+
     void commands::reset_status()
     {
         status = EMPTY;
         dirty = true;
+        lex_all = true;
         delete t_cmd;
-        t_cmd = NULL;
+        t_cmd = t_last = NULL;
         t_par = NULL;
         cmd = NULL;
     }
 
-    void commands::add_commands_from_set(command_set &C_set)
-    {
-        LC_LOG_VERBOSE("set[%p] root[%p]",&C_set,&root);
-        command *C_list = C_set.get();
-        while (C_list != NULL) {
-            command *cmd = C_list;
-            C_list = C_list->next;
-            // break command string into tokens
-            std::unique_ptr<token> Tadd(libchars::lexer(cmd->cmd_str));
-            if (Tadd.get() == NULL)
-                continue;
-            // add command word(s) to dictionary
-            token *T = Tadd.get();
-            command_node *cnode = root.add(T->value,cmd->mask,cmd->hidden);
-            T = T->next;
-            while (T != NULL && cnode != NULL) {
-                if ((cnode = cnode->add_root(cmd->mask,cmd->hidden)) != NULL) {
-                    cnode = cnode->add(T->value,cmd->mask,cmd->hidden);
-                    T = T->next;
-                }
-            }
-            // associate dictionary node with command
-            if (cnode != NULL) {
-                dirty = true;
-                cnode->associate(cmd);
-                C_sorted.insert(cmd);
-            }
-        }
-    }
-
     void commands::build_commands()
     {
-        // rebuild dictionary and sorted list if any of the command sets were modified
-        bool rebuild = C_set_default.modified();
-        command_sets_t::iterator csi = C_sets.begin(); 
-        while (csi != C_sets.end()) { // run through all sets to clear modify flag, even if default set already indicates 'rebuild'
-            command_set &C_set = csi->second;
-            if (C_set.modified()) rebuild = true;
-            ++csi;
+        // take the newest view of the catalog; changes to a shared catalog
+        // are committed by its owner, a private catalog is committed here
+        if (C_owned) {
+            C_catalog->refresh();
+            C_catalog->commit();
         }
-        if (rebuild) {
-          root.clear();
-          C_sorted.clear();
-          add_commands_from_set(C_set_default);
-          csi = C_sets.begin();
-          while (csi != C_sets.end()) {
-              add_commands_from_set(csi->second);
-              ++csi;
-          }
+        const command_view *V = C_catalog->pin(C_reader);
+        if (V->epoch != overlay_epoch) {
+            overlay_epoch = V->epoch;
+            overlay = V->overlay;
+            dirty = true;
         }
     }
 
@@ -1382,6 +2472,20 @@ namespace libchars {
     {
         this->timeout = 0;
     }
+
+    void commands::enable_abbreviations()
+    {
+        abbreviate = true;
+        dirty = true;
+        tab.valid = false;
+    }
+
+    void commands::disable_abbreviations()
+    {
+        abbreviate = false;
+        dirty = true;
+        tab.valid = false;
+    }
     
     commands::status_t commands::run(command::filter_t mask_)
     {
@@ -1401,12 +2505,22 @@ namespace libchars {
 
           while (true) {
               (void)edit.edit(*this,timeout);
+              if (edit.menu_shown() && edit.key() != KEY_ENTER && edit.key() != SEQ_TIMEOUT && edit.key() != FORCED_RET) {
+                  // TAB, arrows, page up/down: move in the menu of options
+                  menu_move(edit.key());
+                  continue;
+              }
               switch (edit.key()) {
               case SEQ_TIMEOUT:
                   return TIMEOUT;
               case FORCED_RET:
                   return FORCED_RETURN;
               case KEY_ENTER:
+                  if (edit.menu_shown()) {
+                      if (menu_accept())
+                          break;
+                      edit.menu_close();
+                  }
                   //TODO: remove quotes from strings
                   dump_tokens();
                   edit.newline();
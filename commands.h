@@ -30,17 +30,21 @@ SOFTWARE.
 #include "history.h"
 
 #include <string>
-#include <stack>
 #include <algorithm>
 #include <vector>
+#include <deque>
 #include <set>
+#include <map>
 
 namespace libchars {
 
+    class parameter_names;
+
     class command
     {
         friend class commands;
-        friend class command_cursor;
+        friend class dictionary_cursor;
+        friend class command_dictionary;
         friend class command_set;
         friend struct command_sort_criteria;
 
@@ -50,7 +54,7 @@ namespace libchars {
 
     public:
         command(const std::string &cmd_str, const char *name = NULL, filter_t mask = 1, token::id_t ID = token::ID_NOT_SET, bool hidden = false);
-        ~command() { delete next; }
+        ~command();
 
     public:
         token::name_t name;
@@ -63,16 +67,85 @@ namespace libchars {
         filter_t mask;
         bool hidden;
         class command *next;
+        mutable parameter_names *names_; // built on first use; see names()
 
     public:
         void set_help(const char *help); // context-sensitive help on parameter
 
         parameter* add(const parameter &par);
+
+        const parameter_names &names() const; // FLAG/KEY names of the (not hidden) parameters
+    };
+
+    struct first_char_map
+    {
+        // 256-bit presence bitmap of first characters; children stored in
+        // character order are indexed by rank (number of set bits below 'c')
+        uint64_t bits[4];
+
+        first_char_map() { clear(); }
+
+        inline void clear() { bits[0] = bits[1] = bits[2] = bits[3] = 0; }
+        inline void set(char c) { bits[(uint8_t)c >> 6] |= ((uint64_t)1 << ((uint8_t)c & 0x3f)); }
+        inline void reset(char c) { bits[(uint8_t)c >> 6] &= ~((uint64_t)1 << ((uint8_t)c & 0x3f)); }
+        inline bool test(char c) const { return (bits[(uint8_t)c >> 6] & ((uint64_t)1 << ((uint8_t)c & 0x3f))) != 0; }
+        inline size_t count() const { return __builtin_popcountll(bits[0]) + __builtin_popcountll(bits[1]) + __builtin_popcountll(bits[2]) + __builtin_popcountll(bits[3]); }
+        inline size_t rank(char c) const
+        {
+            size_t w = (uint8_t)c >> 6, r = 0;
+            for (size_t i = 0; i < w; ++i)
+                r += __builtin_popcountll(bits[i]);
+            return r + __builtin_popcountll(bits[w] & (((uint64_t)1 << ((uint8_t)c & 0x3f)) - 1));
+        }
+    };
+
+    class parameter_names
+    {
+        // FLAG/KEY names of the parameters of a command in a compact trie: a
+        // prefix is found in time proportional to its length, whatever the
+        // number of parameters; the names below a node are a range of the
+        // sorted names, so names already on the line are left out with one
+        // bit per name (a word of bits for up to 64 names)
+    public:
+        typedef uint32_t index_t;
+        const static index_t NONE = (index_t)-1;
+        typedef std::vector<uint64_t> mask_t; // bit per name (in sorted order)
+
+    private:
+        struct node
+        {
+            index_t from;   // label: characters [from,to) of the names below
+            index_t to;
+            index_t lo;     // names below: [lo,hi) in sorted order
+            index_t hi;
+            index_t child;  // first child; children in byte order
+            index_t map;    // first character map of children; NONE if no children
+        };
+        std::vector<node> nodes;
+        std::vector<first_char_map> maps;
+        std::vector<std::string> sorted;
+        std::vector<index_t> par; // index into command parameters of each name
+
+        void build(index_t n, index_t lo, index_t hi, index_t depth);
+
+    public:
+        parameter_names(const parameters_t &parameters);
+
+        inline size_t size() const { return sorted.size(); }
+        inline const std::string &name(size_t i) const { return sorted[i]; }
+        inline size_t par_idx(size_t i) const { return par[i]; } // into command parameters
+
+        bool find(const char *prefix, size_t length, size_t &lo, size_t &hi) const; // names starting with 'prefix': [lo,hi)
+        size_t available(size_t lo, size_t hi, const mask_t &given, size_t &first, size_t &last) const; // names in [lo,hi) not given; first + last of them
+
+        inline void clear(mask_t &given) const { given.assign((sorted.size() + 63) / 64, 0); }
+        inline void give(mask_t &given, size_t i) const { given[i / 64] |= ((uint64_t)1 << (i % 64)); }
+        inline bool is_given(const mask_t &given, size_t i) const { return (given[i / 64] & ((uint64_t)1 << (i % 64))) != 0; }
     };
 
     class command_node
     {
-        friend class command_cursor;
+        friend class command_dictionary;
 
     public:
         std::string part;
@@ -81,9 +154,8 @@ namespace libchars {
 
     private:
         class command *cmd;
-        class command_node *head; // first child
-        class command_node *tail; // last child
-        class command_node *next; // next sibling
+        std::vector<command_node*> children; // in order of first character
+        first_char_map first; // first characters of children
         class command_node *start; // next word
 
     public:
@@ -96,6 +168,8 @@ namespace libchars {
         command_node *add_node(command_node *parent, const std::string &part, command::filter_t mask, bool hidden = false);
         void dump(size_t level); //DEBUG
 
+        command_node *child(char c) const;
+
     public:
         void clear();
 
@@ -109,26 +183,254 @@ namespace libchars {
         inline void dump() { dump(0); }
     };
 
-    class command_cursor
+    class command_dictionary
     {
+        // frozen form of a command_node tree: nodes in one contiguous array
+        // (node 0 = root), labels in one interned byte pool, and the children
+        // of a node as a contiguous index range sorted by first character;
+        // a case-insensitive dictionary has its labels folded to lower case,
+        // with the original spelling in a second pool at the same offsets
+
+        friend class dictionary_cursor;
+
+    public:
+        typedef uint32_t index_t;
+        const static index_t NONE = (index_t)-1;
+
+        struct node
+        {
+            index_t label;          // offset of label in label pool
+            index_t label_length;
+            index_t child;          // first child
+            index_t n_children;
+            index_t map;            // first character map of children; NONE if no children
+            index_t start;          // root node of next word; NONE if no more words
+            index_t cmd;            // index into command table; NONE if no command ends here
+            index_t words;          // complete words ending in this subtree (within the current word)
+            command::filter_t mask; // OR of masks of all commands through this node
+            command::filter_t visible; // OR of masks of commands through this node that are not hidden
+            command::filter_t every; // filter bits under which every word ending in this subtree is visible (TAB summary)
+        };
+
+    private:
+        std::vector<node> nodes;
+        std::vector<first_char_map> maps;
+        std::string labels;
+        std::string originals; // original spelling of labels; empty unless case-insensitive
+        bool ignore_case;
+        mutable std::vector<command*> cmds; // mapped snapshot: NULL until first used
+        index_t garbage; // nodes left unused by in-place updates
+
+        // lookups go through these; they refer to the vectors above or to a
+        // mapped snapshot (read-only until thawed)
+        const node *v_nodes;
+        size_t v_n_nodes;
+        const first_char_map *v_maps;
+        size_t v_n_maps;
+        const char *v_labels;
+        size_t v_labels_length;
+        const char *v_originals; // same as v_labels if case-sensitive
+        const uint8_t *v_fold; // FOLD or IDENTITY
+        const void *image; // mapped snapshot; NULL if not mapped; commands in table owned by dictionary
+        size_t image_size; // 0 if image is not mapped by dictionary (compiled in)
+        void *control; // generation counter of shared catalog; NULL if not attached
+        uint64_t generation; // generation of attached catalog
+        std::string catalog; // name of attached catalog
+        uint64_t catalog_hash;
+        struct spelling; // typo index on words
+        mutable spelling *speller; // built on first suggest(); dropped on any change
+
+        command_dictionary(const command_dictionary&);
+        void operator=(const command_dictionary&);
+
+    public:
+        const static uint32_t SNAPSHOT_VERSION = 5;
+        const static size_t MAX_WORD = 64; // words up to this length are followed without heap memory (cursor path, word buffers)
+
+        command_dictionary() : ignore_case(false),image(NULL),image_size(0),control(NULL),generation(0),catalog_hash(0),speller(NULL) { clear(); }
+        ~command_dictionary();
+
     private:
-        typedef std::stack<command_node*> command_node_stack_t;
-        command_node_stack_t S; // [root] -> node1 -> ... -> nodeX (top of stack)
-        std::string w; // starts empty; word from root@root_idx --> command_node@idx
-        command_node *root; // base command_node, i.e. start of command_node tree
+        struct loader; // sorted command keys (bulk build)
+        struct interned_t; // hash index on label pool
+        struct snapshot; // file layout
+
+        static const uint8_t FOLD[256]; // ASCII upper case --> lower case
+        static const uint8_t IDENTITY[256];
+
+        index_t intern(const char *s, const char *original, size_t length, interned_t &interned);
+        void aggregate(index_t i);
+        void freeze(const command_node *n, index_t i, interned_t &interned);
+        void load(const loader &L, index_t i, size_t lo, size_t hi, size_t d, size_t o, bool word_root, interned_t &interned);
+
+        index_t new_node();
+        index_t add_child(index_t parent, const char *s, const char *original, size_t length);
+        void remove_child(index_t parent, index_t n);
+        void split_node(index_t n, index_t length);
+        void merge_node(index_t n);
+        index_t locate(const command *cmd, std::vector<index_t> &path) const;
+        void dump(index_t n, size_t level) const; //DEBUG
+
+        void update_views(); // point views at vectors (after any change)
+        void unmap();
+        void serialize(std::string &image, uint64_t hash) const;
+        bool use(const void *p, size_t size, uint64_t hash, bool verify); // adopt mapping; false (not unmapped) if not usable
+        command *create(index_t c) const; // new command from record of mapped snapshot
+        command *materialize(index_t c) const;
+
+    public:
+        void clear();
+
+        void build(const command_node &tree); // freeze tree built with command_node::add(); case-sensitive
+        void build(const std::vector<command*> &commands, bool ignore_case = false); // bulk build: sort all commands + build in one pass
+        inline bool case_insensitive() const { return ignore_case; } // commands that differ only in case are duplicates
+
+        // in-place updates; only the path to the command is touched
+        void insert(command *cmd);
+        bool remove(const command *cmd);
+        inline bool fragmented() const { return garbage > 64 && garbage > (nodes.size() / 2); } // rebuild to compact
+
+        // snapshot: position-independent image of the dictionary + its
+        // commands and parameters; 'hash' identifies the command definitions
+        // (application-defined), load() fails on any mismatch so that the
+        // caller can fall back to building the dictionary
+        bool save(const char *path, uint64_t hash) const;
+        bool load(const char *path, uint64_t hash);
+
+        // compiled-in snapshot: save_source() writes the image as a C array
+        // (+ "<symbol>_size") at build time; load() of that array uses it in
+        // place (read-only data, never copied), so nothing is built at startup
+        bool save_source(const char *path, const char *symbol, uint64_t hash) const;
+        bool load(const void *image, size_t size, uint64_t hash);
+
+        // shared catalog: snapshot published in shared memory (POSIX name,
+        // e.g. "/cli"); attached processes map the same pages and notice a
+        // newer publication through its generation counter
+        bool publish(const char *name, uint64_t hash) const;
+        bool attach(const char *name, uint64_t hash);
+        bool outdated() const; // newer generation of attached catalog published
+        inline bool reattach() { return attach(catalog.c_str(), catalog_hash); }
+        inline bool reattach(command_dictionary &d) const { return d.attach(catalog.c_str(), catalog_hash); } // 'd' attaches to same catalog
+
+        inline bool mapped() const { return image != NULL; }
+        void thaw(); // copy mapped snapshot into vectors; commands are no longer owned by dictionary
+        void copy(const command_dictionary &src); // 'src' is only read; commands of a mapped 'src' are created anew
+
+        bool visible(index_t c, command::filter_t mask, bool ignore_hidden) const; // command in table is visible; does not create it
+
+        // "did you mean": distinct words of all commands (any position)
+        // within edit distance 2 (insert, delete, substitute, transpose)
+        typedef std::vector<std::pair<size_t,std::string> > suggestions_t; // (distance, word)
+        void suggest(const std::string &word, suggestions_t &match) const;
+
+        inline index_t child(index_t n, char c) const // child of 'n' starting with 'c'; NONE if not found
+        {
+            const node &N = v_nodes[n];
+            if (N.map == NONE || !v_maps[N.map].test(c))
+                return NONE;
+            return N.child + v_maps[N.map].rank(c);
+        }
+
+        inline const node &at(index_t n) const { return v_nodes[n]; }
+        inline bool reachable(index_t n, command::filter_t mask, bool ignore_hidden) const // any command through 'n' passes filter
+        {
+            return ((ignore_hidden ? v_nodes[n].mask : v_nodes[n].visible) & mask) != 0;
+        }
+        void collect(index_t n, command::filter_t mask, bool ignore_hidden, std::vector<command*> &match) const; // commands through 'n' that pass filter
+        size_t count(index_t n, command::filter_t mask) const; // words ending in subtree of 'n' (within word) that are visible with 'mask'
+        inline const char *label(index_t n) const { return v_labels + v_nodes[n].label; }
+        inline const char *original(index_t n) const { return v_originals + v_nodes[n].label; } // label as spelled in command
+        inline char fold(char c) const { return (char)v_fold[(uint8_t)c]; } // input character as stored in labels
+        inline command *get(index_t n) const { return v_nodes[n].cmd == NONE ? NULL : command_at(v_nodes[n].cmd); }
+
+        inline size_t size() const { return v_n_nodes; }
+        inline index_t n_commands() const { return cmds.size(); }
+        inline command *command_at(index_t c) const
+        {
+            command *cmd = __atomic_load_n(&cmds[c], __ATOMIC_ACQUIRE);
+            return (cmd != NULL) ? cmd : materialize(c);
+        }
+
+        inline void dump() const { dump(0,0); }
+    };
+
+    struct label_view
+    {
+        // characters in the label pool of a dictionary; not owned, valid
+        // until the dictionary changes
+        const char *str;
+        size_t length;
+
+        label_view() : str(NULL),length(0) {}
+        label_view(const char *s, size_t n) : str(s),length(n) {}
+        inline bool empty() const { return length == 0; }
+    };
+
+    class word_buffer
+    {
+        // word assembled by a cursor (see word()); kept in place for words of
+        // up to MAX_WORD characters, on the heap only for longer ones
+    private:
+        char fixed[command_dictionary::MAX_WORD + 1];
+        std::string spill;
+        char *s;
+        size_t n;
+
+        word_buffer(const word_buffer&);
+        void operator=(const word_buffer&);
+
+    public:
+        word_buffer() : s(fixed),n(0) { fixed[0] = 0; }
+
+        char *fit(size_t length); // room for 'length' characters + terminator; contents undefined
+        void assign(const char *str, size_t length);
+
+        inline const char *str() const { return s; }
+        inline size_t length() const { return n; }
+    };
+
+    class dictionary_cursor
+    {
+        // no heap memory for words of up to MAX_WORD characters: the path
+        // within the current word is a stack of that size (every node on the
+        // path adds at least one character), continued on the heap only for
+        // longer words; the word itself is not kept but assembled from the
+        // labels on the path when asked for
+    private:
+        typedef command_dictionary::index_t index_t;
+        index_t S[command_dictionary::MAX_WORD]; // [root] -> node1 -> ... -> nodeX (top of stack = path(depth - 1))
+        std::vector<index_t> S_deep; // path beyond MAX_WORD nodes; empty for shorter words
+        size_t depth;
+        size_t w_length; // length of word from root@root_idx --> command_node@idx
+        const command_dictionary *dict;
+        index_t root; // base node, i.e. start of command_node tree
         size_t root_idx; // start index in root node
         size_t idx; // character index; on root node 0 = root_idx; on other nodes 0 = 0
 
+        inline const command_dictionary::node &node(index_t n) const { return dict->at(n); }
+        inline index_t path(size_t k) const { return (k < command_dictionary::MAX_WORD) ? S[k] : S_deep[k - command_dictionary::MAX_WORD]; }
+        inline void replace_top(index_t n) { if (depth <= command_dictionary::MAX_WORD) S[depth - 1] = n; else S_deep[depth - 1 - command_dictionary::MAX_WORD] = n; }
+        void push(index_t n);
+        index_t next_sibling(command::filter_t mask, bool ignore_hidden) const; // next sibling of top of stack that passes filter
+        label_view segment(size_t k) const; // part of word in node 'k' of path (0 = root)
+
     public:
-        command_cursor(command_node *r = NULL, size_t r_idx = 0);
-        command_cursor(const command_cursor &n);
+        dictionary_cursor() : depth(0),w_length(0),dict(NULL),root(0),root_idx(0),idx(0) {} // not valid
+        dictionary_cursor(const command_dictionary &d);
+
+        void branch(); // current position becomes the base of a new search/enumeration
 
-        inline bool top() const { return (S.empty() && idx == root_idx); }
-        inline command_node *current() const { return S.empty() ? root : S.top(); }
+        inline bool top() const { return (depth == 0 && idx == root_idx); }
+        inline index_t current() const { return (depth == 0) ? root : path(depth - 1); }
         inline size_t current_idx() const { return idx; }
         inline bool end() const { return remainder().empty(); }
-        inline bool valid() const { return (current() != NULL); }
-        inline const std::string &word() const { return w; }
+        inline bool valid() const { return (dict != NULL && current() != command_dictionary::NONE); }
+        inline bool reachable(command::filter_t mask, bool ignore_hidden) const { return valid() && dict->reachable(current(), mask, ignore_hidden); }
+        inline size_t word_length() const { return w_length; }
+        size_t word(char *buf, size_t size) const; // as snprintf(): length of word, copied into 'buf' as far as it fits
+        size_t word(word_buffer &w) const; // whole word, however long
+        int compare(const dictionary_cursor &c) const; // byte order of words, as memcmp()
+        inline class command *get() const { return valid() ? dict->get(current()) : NULL; }
 
         bool command(command::filter_t mask, bool ignore_hidden = false) const;
         bool subword(command::filter_t mask, bool ignore_hidden = false) const;
@@ -138,13 +440,78 @@ namespace libchars {
 
         void rewind();
 
-        std::string remainder() const;
+        label_view remainder() const; // rest of label of current node
 
-        bool next();
+        bool next(command::filter_t mask = command::UNLOCK_ALL, bool ignore_hidden = true); // skips subtrees without commands that pass filter
 
         bool next_root();
 
-        bool find(const std::string &search, command::filter_t mask, bool ignore_hidden = false);
+        bool find(const char *search, size_t length, command::filter_t mask, bool ignore_hidden = false);
+        inline bool find(const std::string &search, command::filter_t mask, bool ignore_hidden = false) { return find(search.data(), search.length(), mask, ignore_hidden); }
+        bool expand(command::filter_t mask, bool ignore_hidden = false); // unique abbreviation: extend to the only complete word below; unchanged if ambiguous
+        size_t complete(command::filter_t mask, dictionary_cursor &common) const; // TAB: number of visible words that extend the current one; 'common' at their longest common extension
+        void suggest(const std::string &search, command::filter_t mask, bool ignore_hidden, command_dictionary::suggestions_t &match) const; // corrections that are complete words here
+
+        void collect(command::filter_t mask, bool ignore_hidden, std::vector<class command*> &match) const; // commands from current position on
+    };
+
+    class command_cursor
+    {
+        // overlay of the dictionaries of the active command sets: every
+        // dictionary is searched in parallel and the results are merged, so
+        // (de)activating a set never rebuilds a dictionary; where more than
+        // one set has the same command, the first set in overlay order wins;
+        // the layers are kept in the cursor itself (no heap memory), so that
+        // cursors can be created and copied freely while a line is edited
+    public:
+        const static size_t MAX_LAYERS = 16; // active command sets searched
+
+    private:
+        struct layer
+        {
+            dictionary_cursor c;
+            bool alive; // search still matches in this dictionary
+            bool pending; // next(): positioned on a word not yet returned
+            bool current; // next(): part of the word last returned
+
+            layer() : alive(false),pending(false),current(false) {}
+            layer(const command_dictionary &d) : c(d),alive(true),pending(false),current(false) {}
+        };
+        layer L[MAX_LAYERS];
+        size_t n_layers;
+        size_t shown; // next(): layer positioned on word last returned; n_layers if none
+        bool enumerating;
+
+        inline bool selected(const layer &l) const { return enumerating ? l.current : (l.alive && l.c.end()); }
+        const dictionary_cursor *spelled() const; // layer with current word; NULL if none
+
+    public:
+        command_cursor() : n_layers(0),shown(0),enumerating(false) {} // not valid
+        command_cursor(const std::vector<const command_dictionary*> &overlay); // first MAX_LAYERS dictionaries
+        command_cursor(const command_cursor &n); // enumerate from current position of 'n'
+        // (assignment copies the position as is)
+
+        bool valid() const;
+        bool end() const;
+        size_t word_length() const;
+        size_t word(char *buf, size_t size) const; // as snprintf(); see dictionary_cursor
+        size_t word(word_buffer &w) const;
+
+        bool command(command::filter_t mask, bool ignore_hidden = false) const;
+        bool subword(command::filter_t mask, bool ignore_hidden = false) const;
+        class command *get(command::filter_t mask, bool ignore_hidden = false) const;
+
+        bool next(command::filter_t mask = command::UNLOCK_ALL, bool ignore_hidden = true); // only stops on complete words; merged in byte order
+
+        bool next_root();
+
+        bool find(const char *search, size_t length, command::filter_t mask, bool ignore_hidden = false);
+        inline bool find(const std::string &search, command::filter_t mask, bool ignore_hidden = false) { return find(search.data(), search.length(), mask, ignore_hidden); }
+        bool expand(command::filter_t mask, bool ignore_hidden = false); // same word in every layer that still matches
+        size_t complete(command::filter_t mask, command_cursor &common, bool &exact) const; // see dictionary_cursor; not 'exact' (an upper bound) if layers may have words in common
+        void suggest(const std::string &search, command::filter_t mask, bool ignore_hidden, command_dictionary::suggestions_t &match) const; // closest first
+
+        void collect(command::filter_t mask, bool ignore_hidden, std::vector<class command*> &match) const; // per layer, in overlay order
     };
 
     struct command_sort_criteria
@@ -186,32 +553,166 @@ namespace libchars {
 
     token *lexer(const std::string &str);
 
+    struct parameter_def
+    {
+        token::type_t ttype; // FLAG, KEY or VALUE
+        token::id_t ID;
+        const char *name; // FLAG/KEY; NULL for VALUE
+        validator::id_t vtype; // KEY/VALUE
+        const char *value; // default value (makes parameter optional); NULL if none
+        const char *help;
+        uint32_t status; // token::MANDATORY and/or token::HIDDEN
+    };
+
+    struct command_def
+    {
+        // commands declared as constant tables, so that no code runs to set
+        // them up; added to a set with command_set::add(), or compiled into
+        // the program as a snapshot (see command_dictionary::save_source())
+        const char *cmd_str;
+        const char *name;
+        token::id_t ID;
+        command::filter_t mask;
+        bool hidden;
+        const char *help;
+        const parameter_def *par;
+        size_t n_par;
+    };
+
+#define LC_PARAMETERS(p) (p), (sizeof(p) / sizeof((p)[0])) // command_def::par + n_par from array
+#define LC_NO_PARAMETERS NULL, 0
+
     class command_set
     {
+        friend class command_catalog;
+
     public:
-        command_set() : C_list(NULL),active(false),dirty(false) {}
-        ~command_set() { delete C_list; }
+        command_set() : C_list(NULL),dictionary(new command_dictionary),active(false),version(0),stale(true),published(false),shared(false),fold(false) {}
+        ~command_set();
     private:
         command *C_list;
+        command_dictionary *dictionary; // commands of this set only; kept across (de)activation
         bool active;
-        bool dirty;
+        uint32_t version; // incremented on every change to the set (incl. (de)activation)
+        bool stale; // dictionary must be (re)built; until first built, commands are loaded in bulk
+        bool published; // dictionary is part of a published view; never changed again, but replaced
+        bool shared; // set of shared catalog: replaced dictionaries and removed commands are retired
+        bool fold; // case-insensitive dictionary
+
+        // retired since last commit of catalog; reclaimed by catalog
+        std::vector<command_dictionary*> r_dictionaries;
+        std::vector<command*> r_commands;
+
+        command_set(const command_set&);
+        void operator=(const command_set&);
+
+        void adopt(); // commands of mapped snapshot become regular commands of set
+        command_dictionary &writable(bool keep = true); // dictionary that can be changed ('keep': copy of published one)
+        inline command_dictionary *fresh() { return published ? new command_dictionary : dictionary; } // to be loaded, then replace()
+        bool replace(command_dictionary *D, bool ok);
+        void retire(command *cmd);
     public:
         command *add(const std::string &cmd_str, const char *name, command::filter_t mask = 0x0001, bool hidden = false);
         command *add(const std::string &cmd_str, token::id_t ID, command::filter_t mask = 0x0001, bool hidden = false);
         command *add(const std::string &cmd_str, const char *name, token::id_t ID, command::filter_t mask = 0x0001, bool hidden = false);
 
-        inline command *get() { return active ? C_list : NULL; }
+        bool add(const command_def *defs, size_t n); // false if any of the commands could not be added
+
+        bool remove(command *cmd); // delete command from set; false if not found
+
+        bool save(const char *path, uint64_t hash); // snapshot of set (see command_dictionary)
+        bool load(const char *path, uint64_t hash); // replaces commands in set; false if snapshot not usable
+
+        bool save_source(const char *path, const char *symbol, uint64_t hash); // compiled-in snapshot (see command_dictionary)
+        bool load(const void *image, size_t size, uint64_t hash); // replaces commands in set; 'image' must outlive set
+
+        bool publish(const char *name, uint64_t hash); // shared catalog (see command_dictionary)
+        bool attach(const char *name, uint64_t hash); // replaces commands in set; follows later publications
+        bool refresh(); // switch to newer publication of attached catalog; true if switched
+
+        inline command *get() { return active ? C_list : NULL; } // NULL while commands are only in a mapped snapshot
+        inline bool empty() const { return C_list == NULL && !dictionary->mapped(); }
+
+        inline void activate() { if (!active) { active = true; ++version; } }
+        inline void deactivate() { if (active) { active = false; ++version; } }
+
+        void ignore_case(bool on = true); // case-insensitive matching of command words; rebuilds dictionary
+
+        const command_dictionary &build(); // rebuild dictionary if stale
+    };
+
+    struct command_view
+    {
+        std::vector<const command_dictionary*> overlay; // dictionaries of active sets (default set first)
+        uint64_t epoch;
+    };
+
+    class command_catalog
+    {
+        // command sets + their dictionaries, shared by any number of sessions
+        // (see commands); sessions only read an immutable view of the active
+        // dictionaries, published by commit(); changes made through cset()
+        // (one writer thread) go to new dictionaries, so sessions in other
+        // threads keep parsing without locks; a replaced view, dictionary or
+        // command is reclaimed once no session can still be using it (epochs)
+        friend class commands;
+
+    public:
+        command_catalog(bool concurrent = true); // false: only used by the thread that changes it
+        ~command_catalog();
+
+    private:
+        typedef std::map<std::string,command_set> command_sets_t;
+        command_sets_t C_sets;
+        command_set C_set_default; // set "0"
+        bool concurrent;
+
+        command_view *current; // published view
+        uint64_t epoch; // epoch of current view; sessions announce the epoch they use
+        uint64_t committed; // version() of current view
+
+        struct reader; // epoch announced by session
+        reader *readers; // lock-free list; entries are reused, freed with catalog
+
+        struct retired_t
+        {
+            uint64_t epoch; // first epoch in which it is no longer used
+            command_view *view;
+            command_dictionary *dictionary;
+            command *cmd;
+        };
+        std::vector<retired_t> retired; // waiting for sessions to move on
+
+        command_catalog(const command_catalog&);
+        void operator=(const command_catalog&);
+
+        uint64_t version() const; // changes whenever a set is added, (de)activated or modified
+        void retire(command_set &C_set, uint64_t e);
+        void reclaim();
+
+        // sessions; never block
+        reader *join();
+        void leave(reader *r);
+        const command_view *pin(reader *r); // view stays valid until next pin()/leave()
+
+    public:
+        command_set &cset(const std::string &set_name); // add command set if not found
+        bool cset_exists(const std::string &set_name) const;
+
+        command_set &cset(); // default command set; always active (once used)
 
-        inline void activate() { if (!active) { active = true; dirty = true; } }
-        inline void deactivate() { if (active) { active = false; dirty = true; } }
+        void deactivate_all_sets(); // except default set
 
-        inline bool modified() { if (dirty) { dirty = false; return true; } else return false; } // clear-on-read
+        bool refresh(); // follow newer publications of attached sets; true if any switched
+        void commit(); // publish changes to sessions; they switch on their next run()
     };
 
     class commands : public edit_object
     {
+        // one session: editor + parse state; the commands themselves live in
+        // a catalog that is either private to the session or shared
     public:
-        commands(terminal_driver &d);
+        commands(terminal_driver &d, command_catalog *shared = NULL); // shared catalog owned by caller; see command_catalog::commit()
         ~commands();
 
     public:
@@ -230,16 +731,21 @@ namespace libchars {
         } status_t;
 
     private:
+        // after an edit only the tokens it touched are lexed (and validated)
+        // again; matching the command words, sort() and the character map
+        // still run over the whole line, so a keystroke costs O(line length)
         void lexer();
 
         const std::string value() const;
 
-        virtual void set(const char *line,size_t idx = std::string::npos) { edit_object::set(line,idx); dirty=true; }
-        virtual void insert(const char c) { edit_object::insert(c); dirty=true; }
-        virtual void del() { edit_object::del(); dirty=true; }
-        virtual void bksp() { edit_object::bksp(); dirty=true; }
-        virtual void wipe() { edit_object::wipe(); dirty=true; }
-        virtual void swap() { edit_object::swap(); dirty=true; }
+        void damage(size_t offset, size_t removed, size_t added); // record edit for incremental lexer
+
+        virtual void set(const char *line,size_t idx = std::string::npos) { edit_object::set(line,idx); lex_all=true; dirty=true; }
+        virtual void insert(const char c) { size_t L = length(); edit_object::insert(c); if (length() > L) damage(insert_idx-1,0,1); dirty=true; }
+        virtual void del() { if (insert_idx < length()) damage(insert_idx,1,0); edit_object::del(); dirty=true; }
+        virtual void bksp() { edit_object::bksp(); dirty=true; } // edit recorded by del()
+        virtual void wipe() { if (insert_idx < length()) damage(insert_idx,length()-insert_idx,0); edit_object::wipe(); dirty=true; }
+        virtual void swap() { if (insert_idx > 0 && length() > 1) damage(std::min(insert_idx,length()-1)-1,2,2); edit_object::swap(); dirty=true; }
 
         virtual size_t render(size_t buf_idx, size_t limit, std::string &sequence);
 
@@ -250,38 +756,83 @@ namespace libchars {
         void parse();
         void validate();
         void auto_complete();
+        void complete_parameter(token *Tcur, size_t t_offset);
+        bool given_parameters(const token *until, parameter_names::mask_t &given) const;
+        bool next_option(command_cursor &cw) const;
+        void show_menu(size_t page, size_t selected);
+        void menu_move(key_e key);
+        bool menu_accept();
         void show_help();
         void show_parameters();
         void reset_status();
 
         inline void emptied() { reset_status(); }
 
-        void add_commands_from_set(command_set &C_set);
         void build_commands();
 
     private:
         editor edit;
 
-        typedef std::set<command*,command_sort_criteria> command_sorted_list_t;
-        command_sorted_list_t C_sorted;
+        command_catalog *C_catalog;
+        bool C_owned; // catalog private to this session
+        command_catalog::reader *C_reader;
 
-        typedef std::map<std::string,command_set> command_sets_t;
-        command_sets_t C_sets;
-        command_set C_set_default; // set "0"
-
-        command_node root;
+        std::vector<const command_dictionary*> overlay; // dictionaries of active sets (default set first)
+        uint64_t overlay_epoch; // epoch of catalog view the overlay was taken from
         command::filter_t mask;
         history *remember;
 
         status_t status;
         bool dirty;
+        bool lex_all; // tokens must be rebuilt from scratch
+        size_t lex_start; // edited region since last lexer() call; npos if none
+        size_t lex_end; // end of edited region (current buffer)
+        size_t lex_old_end; // end of edited region (token offsets)
         token* t_cmd; // first token in linked-list (aka first command token)
         token* t_par; // first parameter token (only set if command found)
+        token* t_last; // last token lexed from the input string (default tokens follow)
         command *cmd; // command (if found during search in tokens)
 
         std::string rendered_str;
         command_chars characters;
         size_t timeout;
+        bool abbreviate; // a unique prefix of a word stands for the word
+        size_t tab_limit; // options on a page of the TAB menu; 0 = as many as fit
+
+        struct tab_state
+        {
+            // position at end of line, kept for the next TAB while the line
+            // (and view + filter) is unchanged
+            command_cursor at;
+            std::string line; // line 'at' was found for
+            std::string spelled; // words before the current one, as spelled in the dictionaries
+            uint64_t epoch; // of overlay
+            command::filter_t mask;
+            bool valid;
+
+            tab_state() : epoch(0),mask(0),valid(false) {}
+        };
+        tab_state tab;
+
+        struct menu_state
+        {
+            // options of the TAB menu; a page is only walked when it is
+            // shown, from the position of its first option
+            std::deque<command_cursor> pages; // page 0: before the first option; deque: cursors are never copy-constructed (branched) when it grows
+            std::vector<size_t> first; // options on the pages before
+            std::vector<std::string> options; // page shown, as displayed
+            std::vector<std::string> names; // options listed up front (parameter names) instead of walked
+            std::string before; // words before the current one (header)
+            std::string word; // current (partial) word; options extend it
+            size_t page; // shown
+            size_t n; // options, as counted by complete()
+            bool exact; // 'n' is not an upper bound
+            bool cr; // current word is an option (first on page 0)
+            bool more; // page after the one shown
+
+            menu_state() : page(0),n(0),exact(false),cr(false),more(false) {}
+        };
+        menu_state menu;
 
     public:
         const char *color_str(command_colors_e color_idx) const;
@@ -289,20 +840,26 @@ namespace libchars {
         inline size_t color_length(command_colors_e color_idx) const { return strlen(color_str(color_idx)); }
 
         inline void clear_screen() { edit.clear_screen(); }
+
+        inline void begin_frame() { edit.begin_frame(); } // batch output of command handlers
+        inline int end_frame() { return edit.end_frame(); }
         
         inline void set_return_timeout(size_t timeout_s) { edit.set_return_timeout(timeout_s); }
         inline void clear_return_timeout() { edit.clear_return_timeout(); }
 
-        command_set &cset(const std::string &set_name); // add command set if not found
-        bool cset_exists(const std::string &set_name);
+        inline command_catalog &catalog() { return *C_catalog; }
 
-        command_set &cset(); // default command set; always active (once used)
+        inline command_set &cset(const std::string &set_name) { return C_catalog->cset(set_name); } // add command set if not found
+        inline bool cset_exists(const std::string &set_name) { return C_catalog->cset_exists(set_name); }
 
-        void deactivate_all_sets(); // except default set
+        inline command_set &cset() { return C_catalog->cset(); } // default command set; always active (once used)
+
+        inline void deactivate_all_sets() { C_catalog->deactivate_all_sets(); } // except default set
 
         void dump_dictionary(); //DEBUG; call after loading commands
         void dump_commands(); //DEBUG; call after loading commands
         void dump_tokens(); //DEBUG; call after run()
+        bool check_tokens(); //DEBUG; tokens kept by the incremental lexer equal a full lex of the line
 
         inline void use(history *h) { remember = h; }
 
@@ -310,6 +867,11 @@ namespace libchars {
 
         void enable_timeout(size_t timeout_s = 10);
         void disable_timeout();
+
+        void enable_abbreviations(); // e.g. "sh int br" for "show interface brief"
+        void disable_abbreviations();
+
+        inline void limit_completions(size_t n) { tab_limit = n; } // options on a page of the TAB menu (default 40); 0 = as many as fit on the screen (all if only printed)
     
         status_t run(command::filter_t mask = command::UNLOCK_ALL); // editor --> command + arguments (validated)
 
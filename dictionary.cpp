@@ -0,0 +1,1500 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+@description Frozen command dictionary
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "commands.h"
+#include "debug.h"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace libchars {
+
+    const command_dictionary::index_t command_dictionary::NONE;
+
+    const uint8_t command_dictionary::FOLD[256] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+        0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+        0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+        0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+        0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+        0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+        0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+        0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+        0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+        0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+        0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+        0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+        0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+        0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+        0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+    };
+
+    const uint8_t command_dictionary::IDENTITY[256] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+        0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+        0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+        0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,
+        0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+        0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+        0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+        0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+        0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+        0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+        0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+        0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+        0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+        0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+        0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+    };
+
+    struct command_dictionary::interned_t
+    {
+        // open addressing on (offset,length) of labels already in the pool;
+        // case-insensitive labels are keyed on folded + original spelling, so
+        // that a node only shows a spelling of a command through it
+        std::vector<std::pair<index_t,index_t> > slots;
+        size_t used;
+
+        interned_t() : slots(1024, std::make_pair(NONE, (index_t)0)), used(0) {}
+
+        static inline size_t hash(const char *s, size_t length)
+        {
+            size_t h = 2166136261u; // FNV-1a
+            for (size_t i = 0; i < length; ++i)
+                h = (h ^ (uint8_t)s[i]) * 16777619u;
+            return h;
+        }
+
+        static inline size_t hash(const char *s, const char *original, size_t length) // 'original' is NULL if case-sensitive
+        {
+            return (original == NULL) ? hash(s, length) : (hash(s, length) * 31) ^ hash(original, length);
+        }
+    };
+
+    struct command_dictionary::spelling
+    {
+        // symmetric delete index: every word is filed under (the hash of) each
+        // string left after deleting up to MAX_DISTANCE of its characters; a
+        // word within that edit distance of a query shares one of these
+        // strings with the deletes of the query, so a lookup only generates
+        // those and checks the few words filed under them
+        const static size_t MAX_DISTANCE = 2;
+
+        std::vector<std::string> words; // distinct (as in labels: folded if case-insensitive)
+        std::vector<std::string> spelled; // words as spelled in commands
+        std::vector<std::pair<uint32_t,index_t> > deletes; // (hash, word); sorted
+        const uint8_t *fold; // of dictionary
+
+        static inline uint32_t hash(const std::string &s, size_t skip1, size_t skip2)
+        {
+            uint32_t h = 2166136261u; // FNV-1a
+            for (size_t i = 0; i < s.length(); ++i)
+                if (i != skip1 && i != skip2)
+                    h = (h ^ (uint8_t)s[i]) * 16777619u;
+            return h;
+        }
+
+        static void variants(const std::string &s, std::vector<uint32_t> &hashes)
+        {
+            // 's' with 0, 1 and 2 characters deleted (MAX_DISTANCE); hashed in
+            // place, without building the strings
+            const size_t npos = std::string::npos;
+            hashes.push_back(hash(s, npos, npos));
+            for (size_t i = 0; i < s.length(); ++i) {
+                hashes.push_back(hash(s, i, npos));
+                for (size_t j = i + 1; j < s.length(); ++j)
+                    hashes.push_back(hash(s, i, j));
+            }
+            std::sort(hashes.begin(), hashes.end());
+            hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+        }
+
+        static size_t distance(const std::string &a, const std::string &b)
+        {
+            // optimal string alignment (Damerau-Levenshtein without
+            // editing a substring twice)
+            std::vector<size_t> r0(b.length() + 1), r1(b.length() + 1), r2(b.length() + 1);
+            for (size_t j = 0; j <= b.length(); ++j)
+                r1[j] = j;
+            for (size_t i = 1; i <= a.length(); ++i) {
+                r2[0] = i;
+                for (size_t j = 1; j <= b.length(); ++j) {
+                    size_t cost = (a[i - 1] == b[j - 1]) ? 0 : 1;
+                    r2[j] = std::min(std::min(r1[j] + 1, r2[j - 1] + 1), r1[j - 1] + cost);
+                    if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+                        r2[j] = std::min(r2[j], r0[j - 2] + 1);
+                }
+                r0.swap(r1);
+                r1.swap(r2);
+            }
+            return r1[b.length()];
+        }
+
+        void add(const std::string &word, const std::string &original, std::vector<index_t> &slots)
+        {
+            // open addressing on words already added (most words appear in
+            // many places of the dictionary)
+            const size_t npos = std::string::npos;
+            if (2 * (words.size() + 1) > slots.size()) {
+                std::vector<index_t> grown(2 * slots.size(), NONE);
+                for (index_t w = 0; w < words.size(); ++w) {
+                    size_t h = hash(words[w], npos, npos) & (grown.size() - 1);
+                    while (grown[h] != NONE)
+                        h = (h + 1) & (grown.size() - 1);
+                    grown[h] = w;
+                }
+                slots.swap(grown);
+            }
+            size_t h = hash(word, npos, npos) & (slots.size() - 1);
+            while (slots[h] != NONE) {
+                if (words[slots[h]] == word)
+                    return;
+                h = (h + 1) & (slots.size() - 1);
+            }
+            slots[h] = words.size();
+            words.push_back(word);
+            spelled.push_back(original);
+        }
+
+        void collect(const command_dictionary &d, index_t n, std::string &word, std::string &original, std::vector<index_t> &slots)
+        {
+            // every node where a command or a next word starts ends a word
+            const node &N = d.at(n);
+            size_t length = word.length();
+            word.append(d.label(n), N.label_length);
+            original.append(d.original(n), N.label_length);
+            if (N.cmd != NONE || N.start != NONE)
+                add(word, original, slots);
+            for (index_t k = 0; k < N.n_children; ++k)
+                collect(d, N.child + k, word, original, slots);
+            if (N.start != NONE) {
+                std::string next, next_original;
+                collect(d, N.start, next, next_original, slots);
+            }
+            word.resize(length);
+            original.resize(length);
+        }
+
+        spelling(const command_dictionary &d) : fold(d.v_fold)
+        {
+            std::string word, original;
+            std::vector<index_t> slots(1024, NONE);
+            collect(d, 0, word, original, slots);
+
+            std::vector<uint32_t> hashes;
+            for (index_t w = 0; w < words.size(); ++w) {
+                hashes.clear();
+                variants(words[w], hashes);
+                for (size_t k = 0; k < hashes.size(); ++k)
+                    deletes.push_back(std::make_pair(hashes[k], w));
+            }
+            std::sort(deletes.begin(), deletes.end());
+            deletes.erase(std::unique(deletes.begin(), deletes.end()), deletes.end());
+        }
+
+        void lookup(const std::string &word, suggestions_t &match) const
+        {
+            std::string query(word);
+            for (size_t i = 0; i < query.length(); ++i)
+                query[i] = fold[(uint8_t)query[i]];
+            std::vector<uint32_t> hashes;
+            variants(query, hashes);
+            std::vector<index_t> candidates;
+            for (size_t k = 0; k < hashes.size(); ++k) {
+                std::vector<std::pair<uint32_t,index_t> >::const_iterator i =
+                    std::lower_bound(deletes.begin(), deletes.end(), std::make_pair(hashes[k], (index_t)0));
+                for (; i != deletes.end() && i->first == hashes[k]; ++i)
+                    candidates.push_back(i->second);
+            }
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+            // hashes only narrow the search: every candidate is checked
+            for (size_t k = 0; k < candidates.size(); ++k) {
+                const std::string &w = words[candidates[k]];
+                size_t skew = (w.length() > query.length()) ? (w.length() - query.length()) : (query.length() - w.length());
+                if (skew > MAX_DISTANCE)
+                    continue;
+                size_t e = distance(query, w);
+                if (e <= MAX_DISTANCE)
+                    match.push_back(std::make_pair(e, spelled[candidates[k]]));
+            }
+        }
+    };
+
+    command_dictionary::~command_dictionary()
+    {
+        unmap();
+        delete speller;
+    }
+
+    void command_dictionary::update_views()
+    {
+        delete speller;
+        speller = NULL;
+        v_nodes = nodes.empty() ? NULL : &nodes[0];
+        v_n_nodes = nodes.size();
+        v_maps = maps.empty() ? NULL : &maps[0];
+        v_n_maps = maps.size();
+        v_labels = labels.data();
+        v_labels_length = labels.length();
+        v_originals = ignore_case ? originals.data() : v_labels;
+        v_fold = ignore_case ? FOLD : IDENTITY;
+    }
+
+    void command_dictionary::clear()
+    {
+        unmap();
+        nodes.clear();
+        maps.clear();
+        labels.clear();
+        originals.clear();
+        cmds.clear();
+        garbage = 0;
+
+        // empty root
+        node root;
+        root.label = root.label_length = 0;
+        root.child = root.n_children = 0;
+        root.map = NONE;
+        root.start = root.cmd = NONE;
+        root.words = 0;
+        root.mask = root.visible = 0;
+        root.every = ~(command::filter_t)0;
+        nodes.push_back(root);
+        update_views();
+    }
+
+    void command_dictionary::build(const command_node &tree)
+    {
+        unmap();
+        nodes.clear();
+        maps.clear();
+        labels.clear();
+        originals.clear();
+        ignore_case = false;
+        cmds.clear();
+        garbage = 0;
+
+        interned_t interned;
+        nodes.resize(1);
+        freeze(&tree, 0, interned);
+        update_views();
+
+        LC_LOG_VERBOSE("dictionary: %zu nodes; %zu label bytes; %zu commands",nodes.size(),labels.size(),cmds.size());
+    }
+
+    command_dictionary::index_t command_dictionary::intern(const char *s, const char *original, size_t length, interned_t &interned)
+    {
+        if (2 * (interned.used + 1) > interned.slots.size()) {
+            // grow + rehash
+            std::vector<std::pair<index_t,index_t> > slots(2 * interned.slots.size(), std::make_pair(NONE, (index_t)0));
+            for (size_t k = 0; k < interned.slots.size(); ++k) {
+                if (interned.slots[k].first == NONE)
+                    continue;
+                index_t first = interned.slots[k].first;
+                size_t h = interned_t::hash(labels.data() + first, ignore_case ? originals.data() + first : NULL, interned.slots[k].second) & (slots.size() - 1);
+                while (slots[h].first != NONE)
+                    h = (h + 1) & (slots.size() - 1);
+                slots[h] = interned.slots[k];
+            }
+            interned.slots.swap(slots);
+        }
+
+        size_t h = interned_t::hash(s, ignore_case ? original : NULL, length) & (interned.slots.size() - 1);
+        while (interned.slots[h].first != NONE) {
+            index_t first = interned.slots[h].first;
+            if (interned.slots[h].second == length && memcmp(labels.data() + first, s, length) == 0 &&
+                (!ignore_case || memcmp(originals.data() + first, original, length) == 0))
+                return first;
+            h = (h + 1) & (interned.slots.size() - 1);
+        }
+
+        index_t offset = labels.size();
+        labels.append(s, length);
+        if (ignore_case)
+            originals.append(original, length);
+        interned.slots[h] = std::make_pair(offset, (index_t)length);
+        ++interned.used;
+        return offset;
+    }
+
+    void command_dictionary::aggregate(index_t i)
+    {
+        // masks are derived from the commands through this node; a word ends
+        // here if a command or a next word does, and is offered by TAB under
+        // the filters its command or next word is visible with
+        node &N = nodes[i];
+        N.mask = N.visible = 0;
+        N.words = (N.cmd != NONE || N.start != NONE) ? 1 : 0;
+        if (N.cmd != NONE) {
+            N.mask = cmds[N.cmd]->mask;
+            N.visible = cmds[N.cmd]->hidden ? 0 : N.mask;
+        }
+        if (N.start != NONE) {
+            N.mask |= nodes[N.start].mask;
+            N.visible |= nodes[N.start].visible;
+        }
+        N.every = (N.words > 0) ? N.visible : ~(command::filter_t)0;
+        for (index_t k = 0; k < N.n_children; ++k) {
+            N.mask |= nodes[N.child + k].mask;
+            N.visible |= nodes[N.child + k].visible;
+            N.words += nodes[N.child + k].words;
+            N.every &= nodes[N.child + k].every;
+        }
+    }
+
+    void command_dictionary::freeze(const command_node *n, index_t i, interned_t &interned)
+    {
+        // fill in node 'i' (already allocated by caller); the children of a node
+        // are allocated as one contiguous group (in first character order)
+        // before descending into them
+        nodes[i].label = intern(n->part.data(), n->part.data(), n->part.length(), interned);
+        nodes[i].label_length = n->part.length();
+        nodes[i].start = NONE;
+        nodes[i].cmd = NONE;
+
+        if (n->cmd != NULL) {
+            nodes[i].cmd = cmds.size();
+            cmds.push_back(n->cmd);
+        }
+
+        const std::vector<command_node*> &children = n->children;
+        const index_t child = nodes.size();
+        nodes[i].child = child;
+        nodes[i].n_children = children.size();
+        nodes[i].map = NONE;
+        if (!children.empty()) {
+            nodes[i].map = maps.size();
+            maps.push_back(n->first);
+        }
+        nodes.resize(nodes.size() + children.size());
+        for (index_t k = 0; k < children.size(); ++k)
+            freeze(children[k], child + k, interned);
+
+        if (n->start != NULL) {
+            const index_t start = nodes.size();
+            nodes[i].start = start;
+            nodes.resize(nodes.size() + 1);
+            freeze(n->start, start, interned);
+        }
+
+        aggregate(i);
+    }
+
+    //- - - - bulk build
+
+    struct command_dictionary::loader
+    {
+        struct word
+        {
+            const char *s; // folded if case-insensitive
+            const char *original;
+            size_t length;
+        };
+
+        struct key
+        {
+            command *cmd;
+            size_t order; // order in which commands were presented
+            size_t word; // first word in 'words'
+            size_t n_words;
+        };
+
+        std::vector<word> words;
+        std::vector<key> keys;
+        std::vector<std::string> folded; // command strings (case-insensitive); reserved up front
+
+        static void fold(const std::string &str, const uint8_t *table, std::string &folded)
+        {
+            folded.resize(str.length());
+            for (size_t i = 0; i < str.length(); ++i)
+                folded[i] = table[(uint8_t)str[i]];
+        }
+
+        static void split(const std::string &str, const char *folded, std::vector<word> &words)
+        {
+            // words are separated by a single space in sanitized command
+            // strings; the only special characters left are escapes; 'folded'
+            // (NULL if case-sensitive) is 'str' folded to lower case
+            size_t i = 0;
+            while (i < str.length()) {
+                if (str[i] == ' ') {
+                    ++i;
+                    continue;
+                }
+                size_t w = i;
+                while (i < str.length() && str[i] != ' ') {
+                    if (str[i] == '\\' && (i + 1) < str.length())
+                        ++i;
+                    ++i;
+                }
+                word W;
+                W.original = str.data() + w;
+                W.s = (folded != NULL) ? (folded + w) : W.original;
+                W.length = i - w;
+                words.push_back(W);
+            }
+        }
+
+        inline const word &at(size_t k, size_t d) const { return words[keys[k].word + d]; }
+
+        struct order
+        {
+            const std::vector<word> *words;
+
+            bool operator() (const key &lhs, const key &rhs) const
+            {
+                // word by word; a word sorts before any longer word it is a prefix
+                // of, and a command sorts before the commands that extend it
+                size_t n = std::min(lhs.n_words, rhs.n_words);
+                for (size_t d = 0; d < n; ++d) {
+                    const word &l = (*words)[lhs.word + d];
+                    const word &r = (*words)[rhs.word + d];
+                    int cmp = memcmp(l.s, r.s, std::min(l.length, r.length));
+                    if (cmp != 0)
+                        return cmp < 0;
+                    if (l.length != r.length)
+                        return l.length < r.length;
+                }
+                if (lhs.n_words != rhs.n_words)
+                    return lhs.n_words < rhs.n_words;
+                return lhs.order < rhs.order;
+            }
+        };
+    };
+
+    void command_dictionary::build(const std::vector<command*> &commands, bool ignore_case_)
+    {
+        unmap();
+        nodes.clear();
+        maps.clear();
+        labels.clear();
+        originals.clear();
+        ignore_case = ignore_case_;
+        cmds.clear();
+
+        // split (sanitized) command strings into words; same result as
+        // libchars::lexer(); case is folded once, here
+        loader L;
+        L.keys.reserve(commands.size());
+        if (ignore_case)
+            L.folded.resize(commands.size());
+        for (size_t c = 0; c < commands.size(); ++c) {
+            loader::key K;
+            K.cmd = commands[c];
+            K.order = c;
+            K.word = L.words.size();
+            const char *folded = NULL;
+            if (ignore_case) {
+                loader::fold(commands[c]->cmd_str, FOLD, L.folded[c]);
+                folded = L.folded[c].data();
+            }
+            loader::split(commands[c]->cmd_str, folded, L.words);
+            K.n_words = L.words.size() - K.word;
+            if (K.n_words > 0)
+                L.keys.push_back(K);
+        }
+
+        loader::order order;
+        order.words = &L.words;
+        std::sort(L.keys.begin(), L.keys.end(), order);
+
+        garbage = 0;
+        interned_t interned;
+        nodes.resize(1);
+        load(L, 0, 0, L.keys.size(), 0, 0, true, interned);
+        update_views();
+
+        LC_LOG_VERBOSE("dictionary: %zu nodes; %zu label bytes; %zu commands",nodes.size(),labels.size(),cmds.size());
+    }
+
+    void command_dictionary::load(const loader &L, index_t i, size_t lo, size_t hi, size_t d, size_t o, bool word_root, interned_t &interned)
+    {
+        // keys [lo,hi) share words 0..d-1 and the first 'o' characters of word
+        // 'd'; node 'i' covers word 'd' up to the longest common prefix of the
+        // range (nothing for the root of a word); same layout as freeze()
+        size_t o2 = o;
+        if (!word_root) {
+            const loader::word &a = L.at(lo, d);
+            const loader::word &b = L.at(hi - 1, d);
+            size_t n = std::min(a.length, b.length);
+            while (o2 < n && a.s[o2] == b.s[o2])
+                ++o2;
+        }
+
+        nodes[i].label = intern((o2 > o) ? (L.at(lo, d).s + o) : "", (o2 > o) ? (L.at(lo, d).original + o) : "", o2 - o, interned);
+        nodes[i].label_length = o2 - o;
+        nodes[i].start = NONE;
+        nodes[i].cmd = NONE;
+
+        // keys with word 'd' ending here come first: the command itself, then
+        // the commands continuing with more words
+        size_t m = lo, e = lo;
+        if (!word_root) {
+            while (m < hi && L.at(m, d).length == o2)
+                ++m;
+            while (e < m && L.keys[e].n_words == (d + 1))
+                ++e;
+        }
+        if (e > lo) {
+            assert(e == (lo + 1)); // to catch duplicate commands
+            nodes[i].cmd = cmds.size();
+            cmds.push_back(L.keys[e - 1].cmd);
+        }
+
+        // children: keys [m,hi) grouped on next character of word 'd'
+        first_char_map first;
+        size_t n_children = 0;
+        for (size_t k = m; k < hi; ++k) {
+            char c = L.at(k, d).s[o2];
+            if (!first.test(c)) {
+                first.set(c);
+                ++n_children;
+            }
+        }
+
+        const index_t child = nodes.size();
+        nodes[i].child = child;
+        nodes[i].n_children = n_children;
+        nodes[i].map = NONE;
+        if (n_children > 0) {
+            nodes[i].map = maps.size();
+            maps.push_back(first);
+        }
+        nodes.resize(nodes.size() + n_children);
+        size_t k = m;
+        for (index_t g = 0; g < n_children; ++g) {
+            size_t g_lo = k;
+            char c = L.at(k, d).s[o2];
+            while (k < hi && L.at(k, d).s[o2] == c)
+                ++k;
+            load(L, child + g, g_lo, k, d, o2, false, interned);
+        }
+
+        if (e < m) {
+            const index_t start = nodes.size();
+            nodes[i].start = start;
+            nodes.resize(nodes.size() + 1);
+            load(L, start, e, m, d + 1, 0, true, interned);
+        }
+
+        aggregate(i);
+    }
+
+    //- - - - in-place updates
+
+    command_dictionary::index_t command_dictionary::new_node()
+    {
+        node N;
+        N.label = N.label_length = 0;
+        N.child = N.n_children = 0;
+        N.map = NONE;
+        N.start = N.cmd = NONE;
+        N.words = 0;
+        N.mask = N.visible = 0;
+        N.every = ~(command::filter_t)0;
+        nodes.push_back(N);
+        update_views();
+        return nodes.size() - 1;
+    }
+
+    command_dictionary::index_t command_dictionary::add_child(index_t parent, const char *s, const char *original, size_t length)
+    {
+        // the children of a node are one contiguous group: the group grows in
+        // place if it is at the end of the node array, otherwise it is copied
+        // to the end (the old slots become garbage)
+        index_t n = nodes[parent].n_children, old = nodes[parent].child, r = 0;
+        if (nodes[parent].map == NONE) {
+            nodes[parent].map = maps.size();
+            maps.push_back(first_char_map());
+        }
+        else {
+            r = maps[nodes[parent].map].rank(s[0]);
+        }
+
+        index_t leaf = new_node();
+        nodes[leaf].label = labels.size();
+        nodes[leaf].label_length = length;
+        labels.append(s, length);
+        if (ignore_case)
+            originals.append(original, length);
+
+        index_t child = old;
+        if (n == 0) {
+            child = leaf;
+        }
+        else if ((old + n) == leaf) {
+            std::rotate(nodes.begin() + old + r, nodes.begin() + leaf, nodes.end());
+        }
+        else {
+            const node N = nodes[leaf];
+            child = leaf;
+            nodes.resize(nodes.size() + n);
+            for (index_t k = 0; k < r; ++k)
+                nodes[child + k] = nodes[old + k];
+            nodes[child + r] = N;
+            for (index_t k = r; k < n; ++k)
+                nodes[child + k + 1] = nodes[old + k];
+            garbage += n;
+        }
+
+        maps[nodes[parent].map].set(s[0]);
+        nodes[parent].child = child;
+        nodes[parent].n_children = n + 1;
+        update_views();
+        return child + r;
+    }
+
+    void command_dictionary::remove_child(index_t parent, index_t n)
+    {
+        // close the gap in the child group; the last slot becomes garbage
+        node &P = nodes[parent];
+        maps[P.map].reset(labels[nodes[n].label]);
+        for (index_t k = n; (k + 1) < (P.child + P.n_children); ++k)
+            nodes[k] = nodes[k + 1];
+        if (--P.n_children == 0)
+            P.map = NONE;
+        ++garbage;
+    }
+
+    void command_dictionary::split_node(index_t n, index_t length)
+    {
+        // node keeps the first 'length' characters of its label; the rest of
+        // the node (children, next word, command) moves to a new only child
+        index_t t = new_node();
+        nodes[t] = nodes[n];
+        nodes[t].label += length;
+        nodes[t].label_length -= length;
+
+        first_char_map first;
+        first.set(labels[nodes[t].label]);
+        node &N = nodes[n];
+        N.label_length = length;
+        N.child = t;
+        N.n_children = 1;
+        N.map = maps.size();
+        N.start = N.cmd = NONE;
+        maps.push_back(first); // aggregates unchanged: same commands pass through
+        update_views();
+    }
+
+    void command_dictionary::merge_node(index_t n)
+    {
+        // node without command and next word absorbs its only child
+        index_t c = nodes[n].child;
+        std::string merged(label(n), nodes[n].label_length);
+        merged.append(label(c), nodes[c].label_length);
+        index_t offset = labels.size();
+        labels.append(merged);
+        if (ignore_case) {
+            merged.assign(original(n), nodes[n].label_length);
+            merged.append(original(c), nodes[c].label_length);
+            originals.append(merged);
+        }
+
+        nodes[n] = nodes[c];
+        nodes[n].label = offset;
+        nodes[n].label_length = merged.length();
+        ++garbage;
+        update_views();
+    }
+
+    command_dictionary::index_t command_dictionary::locate(const command *cmd, std::vector<index_t> &path) const
+    {
+        // path: root --> node with command (including roots of words)
+        std::string folded;
+        if (ignore_case)
+            loader::fold(cmd->cmd_str, FOLD, folded);
+        std::vector<loader::word> words;
+        loader::split(cmd->cmd_str, ignore_case ? folded.data() : NULL, words);
+        path.assign(1, 0);
+        index_t cur = 0;
+        for (size_t d = 0; d < words.size(); ++d) {
+            if (d > 0) {
+                cur = nodes[cur].start;
+                if (cur == NONE)
+                    return NONE;
+                path.push_back(cur);
+            }
+            size_t o = 0;
+            while (o < words[d].length) {
+                cur = child(cur, words[d].s[o]);
+                if (cur == NONE)
+                    return NONE;
+                size_t length = nodes[cur].label_length;
+                if ((o + length) > words[d].length || memcmp(label(cur), words[d].s + o, length) != 0)
+                    return NONE;
+                path.push_back(cur);
+                o += length;
+            }
+        }
+        if (words.empty() || nodes[cur].cmd == NONE || cmds[nodes[cur].cmd] != cmd)
+            return NONE;
+        return cur;
+    }
+
+    void command_dictionary::insert(command *cmd)
+    {
+        std::string folded;
+        if (ignore_case)
+            loader::fold(cmd->cmd_str, FOLD, folded);
+        std::vector<loader::word> words;
+        loader::split(cmd->cmd_str, ignore_case ? folded.data() : NULL, words);
+        if (words.empty())
+            return;
+        thaw();
+        delete speller; // words completed or removed without new nodes too
+        speller = NULL;
+
+        std::vector<index_t> path(1, 0);
+        index_t cur = 0;
+        for (size_t d = 0; d < words.size(); ++d) {
+            if (d > 0) {
+                if (nodes[cur].start == NONE) {
+                    index_t start = new_node();
+                    nodes[cur].start = start;
+                }
+                cur = nodes[cur].start;
+                path.push_back(cur);
+            }
+            const char *s = words[d].s;
+            size_t length = words[d].length, o = 0;
+            while (o < length) {
+                index_t c = child(cur, s[o]);
+                if (c == NONE) {
+                    cur = add_child(cur, s + o, words[d].original + o, length - o);
+                    path.push_back(cur);
+                    break;
+                }
+                size_t p = 0, label_length = nodes[c].label_length;
+                const char *l = label(c);
+                while (p < label_length && (o + p) < length && l[p] == s[o + p])
+                    ++p;
+                if (p < label_length)
+                    split_node(c, p);
+                path.push_back(c);
+                cur = c;
+                o += p;
+            }
+        }
+
+        assert(nodes[cur].cmd == NONE); // to catch duplicate commands
+        nodes[cur].cmd = cmds.size();
+        cmds.push_back(cmd);
+
+        for (size_t k = path.size(); k-- > 0; )
+            aggregate(path[k]);
+    }
+
+    bool command_dictionary::remove(const command *cmd)
+    {
+        std::vector<index_t> path;
+        index_t n = locate(cmd, path);
+        if (n == NONE)
+            return false;
+        thaw();
+        delete speller; // words completed or removed without new nodes too
+        speller = NULL;
+
+        // command table stays dense: last command moves into the free slot
+        index_t c = nodes[n].cmd, last = cmds.size() - 1;
+        if (c != last) {
+            std::vector<index_t> last_path;
+            index_t m = locate(cmds[last], last_path);
+            assert(m != NONE);
+            cmds[c] = cmds[last];
+            nodes[m].cmd = c;
+        }
+        cmds.pop_back();
+        nodes[n].cmd = NONE;
+
+        // bottom-up: drop nodes that lead nowhere, merge single-child chains
+        // (not on roots of words) and recompute aggregates along the path
+        for (size_t k = path.size() - 1; k > 0; --k) {
+            index_t x = path[k], parent = path[k - 1];
+            const node &X = nodes[x];
+            if (X.cmd == NONE && X.start == NONE && X.n_children == 0) {
+                if (nodes[parent].start == x) {
+                    nodes[parent].start = NONE;
+                    ++garbage;
+                }
+                else {
+                    remove_child(parent, x);
+                }
+                continue;
+            }
+            if (X.cmd == NONE && X.start == NONE && X.n_children == 1 && X.label_length > 0)
+                merge_node(x);
+            aggregate(x);
+        }
+        aggregate(0);
+        return true;
+    }
+
+    //- - - - snapshot
+
+    struct command_dictionary::snapshot
+    {
+        // all references are offsets from the start of the file or indices,
+        // so the file can be used wherever it is mapped; sections start on an
+        // 8-byte boundary, in the order listed in the header
+        struct header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint32_t node_size;
+            uint32_t map_size;
+            uint64_t hash; // command definitions (application-defined)
+            uint64_t size; // whole file
+            uint64_t nodes, n_nodes;
+            uint64_t maps, n_maps;
+            uint64_t labels, labels_length;
+            uint64_t originals; // original spelling of labels (case-insensitive); 0 if none
+            uint64_t commands, n_commands;
+            uint64_t parameters, n_parameters;
+            uint64_t strings, strings_length;
+        };
+
+        struct string
+        {
+            uint32_t offset; // into string pool
+            uint32_t length;
+        };
+
+        struct command
+        {
+            string cmd_str, name, help;
+            int32_t ID;
+            uint32_t hidden;
+            uint64_t mask;
+            uint32_t par; // first parameter
+            uint32_t n_par;
+        };
+
+        struct parameter
+        {
+            string name, value, help;
+            int32_t ID;
+            uint32_t ttype;
+            uint32_t status;
+            int32_t vtype;
+        };
+
+        static const char MAGIC[8];
+        const static uint32_t ENDIAN_MARK = 0x01020304;
+
+        static inline uint64_t align(uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+        static string put(std::string &pool, const std::string &s)
+        {
+            string S;
+            S.offset = pool.size();
+            S.length = s.length();
+            pool.append(s);
+            return S;
+        }
+
+        static inline bool in(const string &S, uint64_t length) { return ((uint64_t)S.offset + S.length) <= length; }
+
+        static void append(std::string &image, const void *p, size_t n)
+        {
+            image.append((const char *)p, n);
+            image.resize(align(image.size()), 0);
+        }
+
+        struct control
+        {
+            // shared catalog: names the current generation of the image; the
+            // image of generation N is in shared memory object "<name>.N"
+            char magic[8];
+            uint64_t generation;
+        };
+
+        static std::string segment(const char *name, uint64_t generation)
+        {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), ".%llu", (unsigned long long)generation);
+            return std::string(name) + suffix;
+        }
+    };
+
+    const char command_dictionary::snapshot::MAGIC[8] = { 'L', 'C', 'D', 'I', 'C', 'T', '\n', 0 };
+
+    void command_dictionary::serialize(std::string &image, uint64_t hash) const
+    {
+        std::string strings;
+        std::vector<snapshot::command> C(cmds.size());
+        std::vector<snapshot::parameter> P;
+        for (size_t c = 0; c < cmds.size(); ++c) {
+            const command *cmd = command_at(c);
+            C[c].cmd_str = snapshot::put(strings, cmd->cmd_str);
+            C[c].name = snapshot::put(strings, cmd->name);
+            C[c].help = snapshot::put(strings, cmd->help);
+            C[c].ID = cmd->ID;
+            C[c].hidden = cmd->hidden ? 1 : 0;
+            C[c].mask = cmd->mask;
+            C[c].par = P.size();
+            C[c].n_par = cmd->par.size();
+            for (size_t k = 0; k < cmd->par.size(); ++k) {
+                const parameter &par = cmd->par[k];
+                snapshot::parameter SP;
+                SP.name = snapshot::put(strings, par.name);
+                SP.value = snapshot::put(strings, par.value);
+                SP.help = snapshot::put(strings, par.help);
+                SP.ID = par.ID;
+                SP.ttype = par.ttype;
+                SP.status = par.status;
+                SP.vtype = par.vtype;
+                P.push_back(SP);
+            }
+        }
+
+        snapshot::header H;
+        memset(&H, 0, sizeof(H));
+        memcpy(H.magic, snapshot::MAGIC, sizeof(H.magic));
+        H.version = SNAPSHOT_VERSION;
+        H.byte_order = snapshot::ENDIAN_MARK;
+        H.node_size = sizeof(node);
+        H.map_size = sizeof(first_char_map);
+        H.hash = hash;
+        H.nodes = snapshot::align(sizeof(H));
+        H.n_nodes = v_n_nodes;
+        H.maps = snapshot::align(H.nodes + v_n_nodes * sizeof(node));
+        H.n_maps = v_n_maps;
+        H.labels = snapshot::align(H.maps + v_n_maps * sizeof(first_char_map));
+        H.labels_length = v_labels_length;
+        H.originals = ignore_case ? snapshot::align(H.labels + v_labels_length) : 0;
+        H.commands = snapshot::align((ignore_case ? H.originals : H.labels) + v_labels_length);
+        H.n_commands = C.size();
+        H.parameters = snapshot::align(H.commands + C.size() * sizeof(snapshot::command));
+        H.n_parameters = P.size();
+        H.strings = snapshot::align(H.parameters + P.size() * sizeof(snapshot::parameter));
+        H.strings_length = strings.size();
+        H.size = snapshot::align(H.strings + strings.size());
+
+        image.clear();
+        image.reserve(H.size);
+        snapshot::append(image, &H, sizeof(H));
+        snapshot::append(image, v_nodes, v_n_nodes * sizeof(node));
+        snapshot::append(image, v_maps, v_n_maps * sizeof(first_char_map));
+        snapshot::append(image, v_labels, v_labels_length);
+        if (ignore_case)
+            snapshot::append(image, v_originals, v_labels_length);
+        snapshot::append(image, C.empty() ? NULL : &C[0], C.size() * sizeof(snapshot::command));
+        snapshot::append(image, P.empty() ? NULL : &P[0], P.size() * sizeof(snapshot::parameter));
+        snapshot::append(image, strings.data(), strings.size());
+        assert(image.size() == H.size);
+    }
+
+    bool command_dictionary::save(const char *path, uint64_t hash) const
+    {
+        if (path == NULL)
+            return false;
+        std::string image;
+        serialize(image, hash);
+
+        // write to temporary file + rename, so that a concurrent load() never
+        // sees a partial file
+        std::string tmp(path);
+        tmp += ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (f == NULL)
+            return false;
+        bool ok = (fwrite(image.data(), image.size(), 1, f) == 1);
+        ok = (fclose(f) == 0) && ok;
+        if (ok)
+            ok = (rename(tmp.c_str(), path) == 0);
+        if (!ok)
+            unlink(tmp.c_str());
+
+        LC_LOG_VERBOSE("snapshot[%s]: %s; %zu bytes",path,ok?"saved":"FAILED",image.size());
+        return ok;
+    }
+
+    bool command_dictionary::save_source(const char *path, const char *symbol, uint64_t hash) const
+    {
+        if (path == NULL || symbol == NULL)
+            return false;
+        std::string image;
+        serialize(image, hash);
+
+        std::string tmp(path);
+        tmp += ".tmp";
+        FILE *f = fopen(tmp.c_str(), "w");
+        if (f == NULL)
+            return false;
+        fprintf(f, "// command dictionary snapshot generated by libchars; do not edit\n\n");
+        fprintf(f, "#include <stddef.h>\n\n");
+        fprintf(f, "extern const unsigned char %s[] __attribute__((aligned(8)));\n", symbol);
+        fprintf(f, "extern const size_t %s_size;\n\n", symbol);
+        fprintf(f, "const unsigned char %s[] __attribute__((aligned(8))) = {", symbol);
+        for (size_t i = 0; i < image.size(); ++i)
+            fprintf(f, "%s0x%02x,", (i % 16) == 0 ? "\n    " : " ", (uint8_t)image[i]);
+        fprintf(f, "\n};\n\nconst size_t %s_size = %zu;\n", symbol, image.size());
+        bool ok = (ferror(f) == 0);
+        ok = (fclose(f) == 0) && ok;
+        if (ok)
+            ok = (rename(tmp.c_str(), path) == 0);
+        if (!ok)
+            unlink(tmp.c_str());
+
+        LC_LOG_VERBOSE("snapshot[%s]: %s; %zu bytes",path,ok?"saved":"FAILED",image.size());
+        return ok;
+    }
+
+    bool command_dictionary::use(const void *p, size_t size, uint64_t hash, bool verify)
+    {
+        // header must match this build exactly; nodes, maps and labels are
+        // used where they are mapped, commands are created when first used
+        if (size < sizeof(snapshot::header))
+            return false;
+        const char *base = (const char *)p;
+        const snapshot::header &H = *(const snapshot::header *)p;
+        bool ok = memcmp(H.magic, snapshot::MAGIC, sizeof(H.magic)) == 0 &&
+                  H.version == SNAPSHOT_VERSION &&
+                  H.byte_order == snapshot::ENDIAN_MARK &&
+                  H.node_size == sizeof(node) &&
+                  H.map_size == sizeof(first_char_map) &&
+                  H.hash == hash &&
+                  H.size == size &&
+                  H.n_nodes > 0 &&
+                  H.nodes == snapshot::align(sizeof(H)) &&
+                  H.maps == snapshot::align(H.nodes + H.n_nodes * sizeof(node)) &&
+                  H.labels == snapshot::align(H.maps + H.n_maps * sizeof(first_char_map)) &&
+                  (H.originals == 0 || H.originals == snapshot::align(H.labels + H.labels_length)) &&
+                  H.commands == snapshot::align((H.originals != 0 ? H.originals : H.labels) + H.labels_length) &&
+                  H.parameters == snapshot::align(H.commands + H.n_commands * sizeof(snapshot::command)) &&
+                  H.strings == snapshot::align(H.parameters + H.n_parameters * sizeof(snapshot::parameter)) &&
+                  H.size == snapshot::align(H.strings + H.strings_length);
+
+        // references of command + parameter records (checked once, so that
+        // materialize() cannot fail); not for an image compiled into the program
+        const snapshot::command *SC = (const snapshot::command *)(base + H.commands);
+        const snapshot::parameter *SP = (const snapshot::parameter *)(base + H.parameters);
+        for (uint64_t c = 0; ok && verify && c < H.n_commands; ++c) {
+            ok = snapshot::in(SC[c].cmd_str, H.strings_length) &&
+                 snapshot::in(SC[c].name, H.strings_length) &&
+                 snapshot::in(SC[c].help, H.strings_length) &&
+                 ((uint64_t)SC[c].par + SC[c].n_par) <= H.n_parameters;
+        }
+        for (uint64_t k = 0; ok && verify && k < H.n_parameters; ++k) {
+            ok = snapshot::in(SP[k].name, H.strings_length) &&
+                 snapshot::in(SP[k].value, H.strings_length) &&
+                 snapshot::in(SP[k].help, H.strings_length);
+        }
+
+        // references of nodes (labels, children, character maps, next word,
+        // command), so that lookups stay inside the image
+        const node *SN = (const node *)(base + H.nodes);
+        const first_char_map *SM = (const first_char_map *)(base + H.maps);
+        const char *SL = base + H.labels;
+        if (ok && verify) // counts too large for the offsets above to be computed without overflow
+            ok = H.n_nodes <= size / sizeof(node) && H.n_maps <= size / sizeof(first_char_map) && H.labels_length <= size;
+        for (uint64_t n = 0; ok && verify && n < H.n_nodes; ++n) {
+            const node &N = SN[n];
+            ok = ((uint64_t)N.label + N.label_length) <= H.labels_length &&
+                 ((uint64_t)N.child + N.n_children) <= H.n_nodes &&
+                 (N.map == NONE ? N.n_children == 0 : (N.map < H.n_maps && SM[N.map].count() == N.n_children)) &&
+                 (N.start == NONE || N.start < H.n_nodes) &&
+                 (N.cmd == NONE || N.cmd < H.n_commands);
+        }
+        // child() indexes children by rank in the map: each child must have a
+        // label (else find() would not consume input) starting with the
+        // character of its rank; children are checked after all labels are
+        for (uint64_t n = 0; ok && verify && n < H.n_nodes; ++n) {
+            const node &N = SN[n];
+            for (index_t c = 0; ok && c < N.n_children; ++c) {
+                const node &C = SN[N.child + c];
+                ok = C.label_length > 0 &&
+                     SM[N.map].test(SL[C.label]) &&
+                     SM[N.map].rank(SL[C.label]) == c;
+            }
+        }
+        if (!ok)
+            return false;
+
+        unmap();
+        nodes.clear();
+        maps.clear();
+        labels.clear();
+        originals.clear();
+        ignore_case = (H.originals != 0);
+        cmds.assign(H.n_commands, NULL);
+        garbage = 0;
+        image = p;
+        image_size = size;
+        delete speller;
+        speller = NULL;
+        v_nodes = (const node *)(base + H.nodes);
+        v_n_nodes = H.n_nodes;
+        v_maps = (const first_char_map *)(base + H.maps);
+        v_n_maps = H.n_maps;
+        v_labels = base + H.labels;
+        v_labels_length = H.labels_length;
+        v_originals = ignore_case ? (base + H.originals) : v_labels;
+        v_fold = ignore_case ? FOLD : IDENTITY;
+
+        LC_LOG_VERBOSE("snapshot: %zu nodes; %zu commands",v_n_nodes,cmds.size());
+        return true;
+    }
+
+    bool command_dictionary::load(const char *path, uint64_t hash)
+    {
+        if (path == NULL)
+            return false;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+            p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        if (!use(p, st.st_size, hash, true)) {
+            LC_LOG_VERBOSE("snapshot[%s]: not usable",path);
+            munmap(p, st.st_size);
+            return false;
+        }
+        return true;
+    }
+
+    bool command_dictionary::load(const void *p, size_t size, uint64_t hash)
+    {
+        // compiled in (see save_source()): used where it is, never unmapped
+        if (p == NULL || ((uintptr_t)p & 7) != 0)
+            return false;
+        if (!use(p, size, hash, false))
+            return false;
+        image_size = 0;
+        return true;
+    }
+
+    bool command_dictionary::publish(const char *name, uint64_t hash) const
+    {
+        if (name == NULL)
+            return false;
+        std::string image;
+        serialize(image, hash);
+
+        int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (st.st_size == sizeof(snapshot::control) || ftruncate(fd, sizeof(snapshot::control)) == 0))
+            p = mmap(NULL, sizeof(snapshot::control), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        snapshot::control *ctl = (snapshot::control *)p;
+        if (memcmp(ctl->magic, snapshot::MAGIC, sizeof(ctl->magic)) != 0) {
+            memcpy(ctl->magic, snapshot::MAGIC, sizeof(ctl->magic));
+            ctl->generation = 0;
+        }
+
+        // image of new generation is complete before the generation counter
+        // refers to it; previous generation stays mapped in attached processes
+        // until they switch
+        uint64_t previous = __atomic_load_n(&ctl->generation, __ATOMIC_ACQUIRE);
+        std::string seg = snapshot::segment(name, previous + 1);
+        shm_unlink(seg.c_str());
+        bool ok = false;
+        fd = shm_open(seg.c_str(), O_RDWR | O_CREAT | O_EXCL, 0444);
+        if (fd >= 0) {
+            void *q = MAP_FAILED;
+            if (ftruncate(fd, image.size()) == 0)
+                q = mmap(NULL, image.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (q != MAP_FAILED) {
+                memcpy(q, image.data(), image.size());
+                munmap(q, image.size());
+                __atomic_store_n(&ctl->generation, previous + 1, __ATOMIC_RELEASE);
+                if (previous > 0)
+                    shm_unlink(snapshot::segment(name, previous).c_str());
+                ok = true;
+            }
+            else {
+                shm_unlink(seg.c_str());
+            }
+        }
+        munmap(p, sizeof(snapshot::control));
+
+        LC_LOG_VERBOSE("catalog[%s]: %s generation %llu; %zu bytes",name,ok?"published":"FAILED to publish",(unsigned long long)(previous + 1),image.size());
+        return ok;
+    }
+
+    bool command_dictionary::attach(const char *name, uint64_t hash)
+    {
+        if (name == NULL)
+            return false;
+        const std::string catalog_name(name); // 'name' may refer to current catalog name
+        int fd = shm_open(catalog_name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        void *ctl = mmap(NULL, sizeof(snapshot::control), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ctl == MAP_FAILED)
+            return false;
+        const snapshot::control *C = (const snapshot::control *)ctl;
+
+        // a generation can be unlinked by the next publication before it is
+        // opened here; retry with the newer generation
+        for (int retry = 0; retry < 3 && memcmp(C->magic, snapshot::MAGIC, sizeof(C->magic)) == 0; ++retry) {
+            uint64_t g = __atomic_load_n(&C->generation, __ATOMIC_ACQUIRE);
+            if (g == 0)
+                break;
+            fd = shm_open(snapshot::segment(catalog_name.c_str(), g).c_str(), O_RDONLY, 0);
+            if (fd < 0)
+                continue;
+            struct stat st;
+            void *p = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+                p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED)
+                continue;
+            if (!use(p, st.st_size, hash, true)) {
+                LC_LOG_VERBOSE("catalog[%s]: generation %llu not usable",catalog_name.c_str(),(unsigned long long)g);
+                munmap(p, st.st_size);
+                break;
+            }
+            control = ctl;
+            generation = g;
+            catalog = catalog_name;
+            catalog_hash = hash;
+            LC_LOG_VERBOSE("catalog[%s]: attached generation %llu",catalog_name.c_str(),(unsigned long long)g);
+            return true;
+        }
+        munmap(ctl, sizeof(snapshot::control));
+        return false;
+    }
+
+    bool command_dictionary::outdated() const
+    {
+        if (control == NULL)
+            return false;
+        const snapshot::control *C = (const snapshot::control *)control;
+        return __atomic_load_n(&C->generation, __ATOMIC_ACQUIRE) != generation;
+    }
+
+    command *command_dictionary::create(index_t c) const
+    {
+        const char *base = (const char *)image;
+        const snapshot::header &H = *(const snapshot::header *)image;
+        const snapshot::command &S = ((const snapshot::command *)(base + H.commands))[c];
+        const snapshot::parameter *SP = (const snapshot::parameter *)(base + H.parameters);
+        const char *str = base + H.strings;
+
+        command *cmd = new command(std::string(str + S.cmd_str.offset, S.cmd_str.length), NULL, S.mask, S.ID, S.hidden != 0);
+        cmd->name.assign(str + S.name.offset, S.name.length);
+        cmd->help.assign(str + S.help.offset, S.help.length);
+        cmd->par.reserve(S.n_par);
+        for (uint32_t k = S.par; k < (S.par + S.n_par); ++k) {
+            parameter par(SP[k].ID, (validator::id_t)SP[k].vtype);
+            par.name.assign(str + SP[k].name.offset, SP[k].name.length);
+            par.value.assign(str + SP[k].value.offset, SP[k].value.length);
+            par.help.assign(str + SP[k].help.offset, SP[k].help.length);
+            par.ttype = (token::type_t)SP[k].ttype;
+            par.status = SP[k].status;
+            cmd->par.push_back(par);
+        }
+        return cmd;
+    }
+
+    command *command_dictionary::materialize(index_t c) const
+    {
+        // first use of a command of a mapped snapshot: create it from its
+        // record; if another thread got there first, its command is used
+        command *cmd = create(c);
+        command *expected = NULL;
+        if (!__atomic_compare_exchange_n(&cmds[c], &expected, cmd, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            delete cmd;
+            return expected;
+        }
+        return cmd;
+    }
+
+    bool command_dictionary::visible(index_t c, command::filter_t mask, bool ignore_hidden) const
+    {
+        command::filter_t cmd_mask;
+        bool cmd_hidden;
+        if (image != NULL) {
+            const snapshot::header &H = *(const snapshot::header *)image;
+            const snapshot::command &S = ((const snapshot::command *)((const char *)image + H.commands))[c];
+            cmd_mask = S.mask;
+            cmd_hidden = (S.hidden != 0);
+        }
+        else {
+            cmd_mask = cmds[c]->mask;
+            cmd_hidden = cmds[c]->hidden;
+        }
+        return (cmd_mask & mask) != 0 && (!cmd_hidden || ignore_hidden);
+    }
+
+    void command_dictionary::collect(index_t n, command::filter_t mask, bool ignore_hidden, std::vector<command*> &match) const
+    {
+        // only subtrees with commands that pass the filter are visited
+        if (!reachable(n, mask, ignore_hidden))
+            return;
+        const node &N = v_nodes[n];
+        if (N.cmd != NONE && visible(N.cmd, mask, ignore_hidden))
+            match.push_back(command_at(N.cmd));
+        for (index_t k = 0; k < N.n_children; ++k)
+            collect(N.child + k, mask, ignore_hidden, match);
+        if (N.start != NONE)
+            collect(N.start, mask, ignore_hidden, match);
+    }
+
+    size_t command_dictionary::count(index_t n, command::filter_t mask) const
+    {
+        // a word ending here is offered if its command or next word is visible;
+        // subtrees in which every word is visible are counted by the builder
+        const node &N = v_nodes[n];
+        if ((N.visible & mask) == 0)
+            return 0;
+        if ((N.every & mask) != 0)
+            return N.words;
+        size_t k = ((N.cmd != NONE && visible(N.cmd, mask, false)) ||
+                    (N.start != NONE && reachable(N.start, mask, false))) ? 1 : 0;
+        for (index_t c = 0; c < N.n_children; ++c)
+            k += count(N.child + c, mask);
+        return k;
+    }
+
+    void command_dictionary::thaw()
+    {
+        if (image != NULL) {
+            for (index_t c = 0; c < cmds.size(); ++c)
+                command_at(c);
+            nodes.assign(v_nodes, v_nodes + v_n_nodes);
+            maps.assign(v_maps, v_maps + v_n_maps);
+            labels.assign(v_labels, v_labels_length);
+            if (ignore_case)
+                originals.assign(v_originals, v_labels_length);
+            // commands are handed over to the owner of the dictionary
+            std::vector<command*> C;
+            C.swap(cmds);
+            unmap();
+            cmds.swap(C);
+            update_views();
+        }
+    }
+
+    void command_dictionary::copy(const command_dictionary &src)
+    {
+        // 'src' may be in use by other threads: it is only read, and its
+        // commands that were created lazily stay owned by it
+        unmap();
+        nodes.assign(src.v_nodes, src.v_nodes + src.v_n_nodes);
+        maps.assign(src.v_maps, src.v_maps + src.v_n_maps);
+        labels.assign(src.v_labels, src.v_labels_length);
+        ignore_case = src.ignore_case;
+        if (ignore_case)
+            originals.assign(src.v_originals, src.v_labels_length);
+        else
+            originals.clear();
+        cmds.resize(src.cmds.size());
+        for (index_t c = 0; c < cmds.size(); ++c)
+            cmds[c] = (src.image != NULL) ? src.create(c) : src.cmds[c];
+        garbage = (src.image != NULL) ? 0 : src.garbage;
+        update_views();
+    }
+
+    void command_dictionary::unmap()
+    {
+        if (image != NULL) {
+            for (index_t c = 0; c < cmds.size(); ++c) {
+                if (cmds[c] != NULL) {
+                    cmds[c]->next = NULL;
+                    delete cmds[c];
+                }
+            }
+            cmds.clear();
+            if (image_size > 0)
+                munmap((void *)image, image_size);
+            image = NULL;
+            image_size = 0;
+        }
+        if (control != NULL) {
+            munmap(control, sizeof(snapshot::control));
+            control = NULL;
+            generation = 0;
+        }
+    }
+
+    //- - - - suggestions
+
+    void command_dictionary::suggest(const std::string &word, suggestions_t &match) const
+    {
+        // built on first use; if another thread got there first, its index
+        // is used
+        spelling *S = __atomic_load_n(&speller, __ATOMIC_ACQUIRE);
+        if (S == NULL) {
+            spelling *expected = NULL;
+            S = new spelling(*this);
+            LC_LOG_VERBOSE("spelling: %zu words; %zu deletes",S->words.size(),S->deletes.size());
+            if (!__atomic_compare_exchange_n(&speller, &expected, S, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                delete S;
+                S = expected;
+            }
+        }
+        S->lookup(word, match);
+    }
+
+    void command_dictionary::dump(index_t n, size_t level) const
+    {
+        if (LC_LOG_CHECK_LEVEL(debug::DEBUG)) {
+            static std::string indent = "                                     ";
+            const node &N = at(n);
+            LC_LOG_DEBUG("%s%s[%u/0x%08x/%s/%p]%s",
+                level>0?indent.substr(0,level*2).c_str():"",
+                N.label_length==0?"--ROOT--":std::string(label(n),N.label_length).c_str(),
+                n,N.mask,N.visible?"VISIBLE":"HIDDEN",get(n),
+                N.start!=NONE?"==>":"");
+
+            ++level;
+
+            if (N.start != NONE)
+                dump(N.start, level);
+
+            for (index_t k = 0; k < N.n_children; ++k)
+                dump(N.child + k, level);
+        }
+    }
+
+}
@@ -25,66 +25,279 @@ SOFTWARE.
 #include "editor.h"
 #include "debug.h"
 
+#include <new>
+#include <algorithm>
+
 namespace libchars {
 
-    struct decode_sequence_t { const char *sequence; key_e result; };
+    void edit_object::assign(const char *s, size_t n)
+    {
+        // wipe previous contents before reuse
+        if (buffer != NULL)
+            secure_zero(buffer, bufsize);
+        buflen = gap_start = 0;
+        gap_end = bufsize;
+
+        if (!reserve(n))
+            n = (bufsize > 0) ? bufsize - 1 : 0;
+        if (n > 0)
+            memcpy(buffer, s, n);
+        buflen = gap_start = n;
+        gap_end = bufsize;
+    }
+
+    bool edit_object::reserve(size_t n)
+    {
+        // keep at least one byte in the gap for the terminating zero returned by data()
+        size_t gap = gap_end - gap_start;
+        if (buffer != NULL && gap > n)
+            return true;
+
+        size_t size = (bufsize > 0) ? bufsize : MIN_CAPACITY;
+        while (size < (buflen + n + 1))
+            size *= 2;
+
+        char *buffer_new = new (std::nothrow) char[size];
+        if (buffer_new == NULL)
+            return false;
+
+        size_t tail = bufsize - gap_end;
+        if (buffer != NULL) {
+            memcpy(buffer_new, buffer, gap_start);
+            memcpy(buffer_new + size - tail, buffer + gap_end, tail);
+            secure_zero(buffer, bufsize);
+            delete[] buffer;
+        }
+        memset(buffer_new + gap_start, 0, size - tail - gap_start);
+
+        buffer = buffer_new;
+        bufsize = size;
+        gap_end = size - tail;
+        return true;
+    }
+
+    void edit_object::move_gap(size_t pos) const
+    {
+        if (pos > buflen)
+            pos = buflen;
+
+        if (pos < gap_start) {
+            // move characters [pos,gap_start) to end of gap
+            size_t n = gap_start - pos;
+            memmove(buffer + gap_end - n, buffer + pos, n);
+            gap_start -= n;
+            gap_end -= n;
+            // do not leave copies of moved characters in the gap
+            secure_zero(buffer + gap_start, ((gap_end - gap_start) < n) ? (gap_end - gap_start) : n);
+        }
+        else if (pos > gap_start) {
+            // move characters [gap_end,gap_end+n) to start of gap
+            size_t n = pos - gap_start;
+            memmove(buffer + gap_start, buffer + gap_end, n);
+            gap_start += n;
+            gap_end += n;
+            size_t gap = gap_end - gap_start;
+            secure_zero(buffer + gap_end - ((gap < n) ? gap : n), (gap < n) ? gap : n);
+        }
+    }
 
-    decode_sequence_t __decode_table[] =
+    void edit_object::copy(size_t idx, size_t n, std::string &out) const
     {
-        { "\x1b[D", KEY_LEFT },
-        { "\x1b[C", KEY_RIGHT },
-        { "\x1b[A", KEY_UP },
-        { "\x1b[B", KEY_DOWN },
-        { "\x1b[5~", KEY_PGUP },
-        { "\x1b[6~", KEY_PGDN },
-        { "\x1b[3~", KEY_DEL },
-        { "\x7f", KEY_BKSP },
-        { "\x01", KEY_SOL },
-        { "\x03", KEY_QUIT },
-        { "\x04", KEY_DEL }, // ^D (will be translated into KEY_EOF in multiline mode)
-        { "\x05", KEY_EOL },
-        { "\x08", KEY_BKSP },
-        { "\x09", KEY_TAB },
-        { "\x0b", KEY_WIPE },
-        { "\x0c", KEY_CLEAR },
-        { "\x0d", KEY_ENTER },
-        { "\x14", KEY_SWAP },
-        { "\x1a", KEY_EOF }, // ^Z (only used in multiline mode)
-
-        { "\x1b\x1b", IGNORE_SEQ },
-        { "\x1b[H", IGNORE_SEQ },
-        { "\x1b[F", IGNORE_SEQ },
-        { "\x1bO", IGNORE_SEQ },
-        { "\x1b[1", IGNORE_SEQ },
-        { "\x1b[2", IGNORE_SEQ },
+        // append the segments on both sides of the gap; the gap stays where it is
+        if (idx >= buflen)
+            return;
+        if (n > (buflen - idx))
+            n = buflen - idx;
+        if (idx < gap_start) {
+            size_t n0 = (n < (gap_start - idx)) ? n : (gap_start - idx);
+            out.append(buffer + idx, n0);
+            idx += n0;
+            n -= n0;
+        }
+        if (n > 0)
+            out.append(buffer + idx + gap_end - gap_start, n);
+    }
+
+    const char *edit_object::data() const
+    {
+        if (buffer == NULL)
+            return "";
+        move_gap(buflen);
+        buffer[buflen] = 0;
+        return buffer;
+    }
+
+
+    // ECMA-48 / VT500-style input parser: byte class -> state transition -> action
+
+    enum decode_inputs {
+        X_CTL = 0,  // C0 control (except those below)
+        X_CAN = 1,  // CAN, SUB (cancel sequence)
+        X_ESC = 2,  // ESC
+        X_INT = 3,  // intermediate: 0x20-0x2f
+        X_DIG = 4,  // parameter digit: 0-9
+        X_SEP = 5,  // parameter separator: ':' ';'
+        X_PRV = 6,  // private marker: '<' '=' '>' '?'
+        X_SS3 = 7,  // 'O' (SS3 after ESC)
+        X_CSI = 8,  // '[' (CSI after ESC)
+        X_FIN = 9,  // other final characters: 0x40-0x7e
+        X_DEL = 10, // DEL
+        X_HI  = 11, // 0x80-0xff
     };
+    //NOTE: keyboard input does not contain control strings (DCS/OSC/PM/APC); ESC + 'P' ']' '^' '_' 'X'
+    // is a 2-byte sequence (e.g. Alt+P), not the start of a string that would swallow keys until ST
 
-    const static size_t DECODE_TABLE_ENTRIES = (sizeof(__decode_table) / sizeof(decode_sequence_t));
+    enum decode_states {
+        P_GR = 0, // ground
+        P_ES = 1, // escape
+        P_EI = 2, // escape intermediate
+        P_CE = 3, // CSI entry
+        P_CP = 4, // CSI parameters
+        P_CI = 5, // CSI intermediate
+        P_CX = 6, // CSI ignore (malformed)
+        P_S3 = 7, // SS3
+    };
+
+    enum decode_actions {
+        A_NONE  = 0x00,
+        A_PRT   = 0x10, // printable character
+        A_EXE   = 0x20, // execute C0 control (key)
+        A_CLR   = 0x30, // start of new sequence
+        A_PAR   = 0x40, // collect parameter character
+        A_COL   = 0x50, // collect private marker / intermediate
+        A_DES   = 0x60, // dispatch ESC sequence
+        A_DCS   = 0x70, // dispatch CSI sequence
+        A_DS3   = 0x80, // dispatch SS3 sequence
+        A_IGN   = 0x90, // end of sequence without key
+    };
+
+    static const uint8_t __decode_inputs[128] =
+    {
+        /* 0x00 */ X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL,
+        /* 0x10 */ X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CTL, X_CAN, X_CTL, X_CAN, X_ESC, X_CTL, X_CTL, X_CTL, X_CTL,
+        /* 0x20 */ X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT, X_INT,
+        /* 0x30 */ X_DIG, X_DIG, X_DIG, X_DIG, X_DIG, X_DIG, X_DIG, X_DIG, X_DIG, X_DIG, X_SEP, X_SEP, X_PRV, X_PRV, X_PRV, X_PRV,
+        /* 0x40 */ X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_SS3,
+        /* 0x50 */ X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_CSI, X_FIN, X_FIN, X_FIN, X_FIN,
+        /* 0x60 */ X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN,
+        /* 0x70 */ X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_FIN, X_DEL,
+    };
+
+    static const uint8_t __decode_transitions[][X_HI+1] =
+    {
+        // STATE:     X_CTL,    X_CAN,    X_ESC,    X_INT,    X_DIG,    X_SEP,    X_PRV,    X_SS3,    X_CSI,    X_FIN,    X_DEL,    X_HI
+        /* P_GR */ { P_GR|A_EXE, P_GR|A_EXE, P_ES|A_CLR, P_GR|A_PRT, P_GR|A_PRT, P_GR|A_PRT, P_GR|A_PRT, P_GR|A_PRT, P_GR|A_PRT, P_GR|A_PRT, P_GR|A_EXE, P_GR|A_IGN, },
+        /* P_ES */ { P_ES|A_EXE, P_GR|A_IGN, P_ES|A_CLR, P_EI|A_COL, P_GR|A_DES, P_GR|A_DES, P_GR|A_DES, P_S3|A_CLR, P_CE|A_CLR, P_GR|A_DES, P_GR|A_IGN, P_GR|A_IGN, },
+        /* P_EI */ { P_EI|A_EXE, P_GR|A_IGN, P_ES|A_CLR, P_EI|A_COL, P_GR|A_DES, P_GR|A_DES, P_GR|A_DES, P_GR|A_DES, P_GR|A_DES, P_GR|A_DES, P_EI,       P_EI,       },
+        /* P_CE */ { P_CE|A_EXE, P_GR|A_IGN, P_ES|A_CLR, P_CI|A_COL, P_CP|A_PAR, P_CP|A_PAR, P_CP|A_COL, P_GR|A_DCS, P_GR|A_DCS, P_GR|A_DCS, P_CE,       P_CE,       },
+        /* P_CP */ { P_CP|A_EXE, P_GR|A_IGN, P_ES|A_CLR, P_CI|A_COL, P_CP|A_PAR, P_CP|A_PAR, P_CX,       P_GR|A_DCS, P_GR|A_DCS, P_GR|A_DCS, P_CP,       P_CP,       },
+        /* P_CI */ { P_CI|A_EXE, P_GR|A_IGN, P_ES|A_CLR, P_CI|A_COL, P_CX,       P_CX,       P_CX,       P_GR|A_DCS, P_GR|A_DCS, P_GR|A_DCS, P_CI,       P_CI,       },
+        /* P_CX */ { P_CX|A_EXE, P_GR|A_IGN, P_ES|A_CLR, P_CX,       P_CX,       P_CX,       P_CX,       P_GR|A_IGN, P_GR|A_IGN, P_GR|A_IGN, P_CX,       P_CX,       },
+        /* P_S3 */ { P_S3|A_EXE, P_GR|A_IGN, P_ES|A_CLR, P_GR|A_IGN, P_S3|A_PAR, P_S3|A_PAR, P_GR|A_IGN, P_GR|A_DS3, P_GR|A_DS3, P_GR|A_DS3, P_GR|A_IGN, P_GR|A_IGN, },
+    };
+
+    // C0 control characters (ground state)
+    static const key_e __control_keys[0x20] =
+    {
+        /* 0x00 */ IGNORE_SEQ, KEY_SOL, IGNORE_SEQ, KEY_QUIT, KEY_DEL, KEY_EOL, IGNORE_SEQ, IGNORE_SEQ,
+        /* 0x08 */ KEY_BKSP, KEY_TAB, IGNORE_SEQ, KEY_WIPE, KEY_CLEAR, KEY_ENTER, IGNORE_SEQ, IGNORE_SEQ,
+        /* 0x10 */ IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, KEY_SWAP, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+        /* 0x18 */ IGNORE_SEQ, IGNORE_SEQ, KEY_EOF, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+    };
+    //NOTE: ^D (0x04) is translated into KEY_EOF in multiline mode; ^Z (0x1a) only used in multiline mode
+
+    // final character of CSI / SS3 sequence (0x40-0x7e); modifier parameters are ignored, e.g. ^[[1;5C = KEY_RIGHT
+    static const key_e __final_keys[0x3f] =
+    {
+        /* '@' */ IGNORE_SEQ, KEY_UP, KEY_DOWN, KEY_RIGHT, KEY_LEFT, IGNORE_SEQ, KEY_EOL, IGNORE_SEQ,
+        /* 'H' */ KEY_SOL, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+        /* 'P' */ IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+        /* 'X' */ IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+        /* '`' */ IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+        /* 'h' */ IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+        /* 'p' */ IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+        /* 'x' */ IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ, IGNORE_SEQ,
+    };
+
+    // CSI <n> ~ (VT220 editing keys)
+    static const key_e __tilde_keys[9] =
+    {
+        /* 0 */ IGNORE_SEQ,
+        /* 1 */ KEY_SOL,    // home
+        /* 2 */ IGNORE_SEQ, // insert
+        /* 3 */ KEY_DEL,
+        /* 4 */ KEY_EOL,    // end
+        /* 5 */ KEY_PGUP,
+        /* 6 */ KEY_PGDN,
+        /* 7 */ KEY_SOL,    // home (rxvt)
+        /* 8 */ KEY_EOL,    // end (rxvt)
+    };
 
     key_e editor::decode_key(uint8_t c)
     {
-        if (seq_N < MAX_DECODE_SEQUENCE) {
+        uint8_t x = (c < 0x80) ? __decode_inputs[c] : (uint8_t)X_HI;
+        uint8_t tr = __decode_transitions[p_state][x];
+        uint8_t action = (tr & 0xf0);
+        p_state = (tr & 0x0f);
+
+        if (action == A_CLR) {
+            seq_N = 0;
+            par_N = 0;
+            p_collect = 0;
+        }
+        if (seq_N < MAX_DECODE_SEQUENCE)
             seq[seq_N++] = c;
-            size_t idx;
-            for (idx = 0; idx < DECODE_TABLE_ENTRIES; ++idx) {
-                const char *T_seq = __decode_table[idx].sequence;
-                size_t T_seq_N = strlen(T_seq);
-                if (memcmp(T_seq, seq, seq_N) == 0) {
-                    if (T_seq_N == seq_N) {
-                        seq_N = 0;
-                        if (obj->mode == MODE_MULTILINE && __decode_table[idx].result == KEY_DEL)
-                            return KEY_EOF;
-                        else
-                            return __decode_table[idx].result;
-                    }
-                    else if (T_seq_N > seq_N) {
-                        return PARTIAL_SEQ;
-                    }
-                }
+
+        key_e result = PARTIAL_SEQ;
+        switch (action) {
+        case A_PRT:
+            seq_N = 0;
+            if (obj->mode == MODE_COMMAND && c == '?')
+                return KEY_HELP;
+            return PRINTABLE_CHAR;
+        case A_EXE:
+            if (p_state == P_GR)
+                seq_N = 0;
+            else if (seq_N > 0)
+                --seq_N; // control character is not part of sequence
+            result = (c == 0x7f) ? KEY_BKSP : __control_keys[c & 0x1f];
+            if (obj->mode == MODE_MULTILINE && c == 0x04)
+                result = KEY_EOF;
+            return result;
+        case A_PAR:
+            if (par_N == 0)
+                par[par_N++] = 0;
+            if (isdigit(c)) {
+                uint32_t v = par[par_N-1] * 10 + (c - '0');
+                par[par_N-1] = (v > 0xffff) ? 0xffff : v;
             }
+            else if (par_N < MAX_DECODE_PARAMS) {
+                par[par_N++] = 0;
+            }
+            return PARTIAL_SEQ;
+        case A_COL:
+            p_collect = c;
+            return PARTIAL_SEQ;
+        case A_DCS:
+            if (p_collect != 0)
+                result = IGNORE_SEQ; // private / intermediate sequences not used for keys
+            else if (c == '~')
+                result = (par_N > 0 && par[0] < (sizeof(__tilde_keys) / sizeof(key_e))) ? __tilde_keys[par[0]] : IGNORE_SEQ;
+            else
+                result = __final_keys[c - 0x40];
+            break;
+        case A_DS3:
+            result = __final_keys[c - 0x40];
+            break;
+        case A_DES:
+        case A_IGN:
+            result = IGNORE_SEQ;
+            break;
+        default:
+            return PARTIAL_SEQ;
         }
 
-        if (seq_N>1 || !isprint(c)) {
+        if (result == IGNORE_SEQ && LC_LOG_CHECK_LEVEL(debug::DEBUG)) {
             size_t i;
             char buffer[256] = "";
             for (i=0; i<seq_N; ++i) {
@@ -98,13 +311,7 @@ namespace libchars {
         }
 
         seq_N = 0;
-
-        if (obj->mode == MODE_COMMAND && c == '?')
-            return KEY_HELP;
-        else if (isprint(c))
-            return PRINTABLE_CHAR;
-        else
-            return IGNORE_SEQ;
+        return result;
     }
 
     void editor::request_render()
@@ -126,10 +333,78 @@ namespace libchars {
         return n;
     }
 
+    uint16_t editor::attr_index(const std::string &sgr)
+    {
+        if (sgr.empty())
+            return 0;
+        for (size_t i = 1; i < attrs.size(); ++i) {
+            if (attrs[i] == sgr)
+                return (uint16_t)i;
+        }
+        if (attrs.size() >= 0xffff)
+            return 0;
+        attrs.push_back(sgr);
+        return (uint16_t)(attrs.size() - 1);
+    }
+
+    void editor::to_cells(const std::string &sequence, cells_t &cells)
+    {
+        // split rendered sequence into displayed characters + active color (SGR) attributes;
+        // other escape sequences do not occupy cells
+        std::string sgr;
+        uint16_t attr = 0;
+        size_t i = 0;
+        while (i < sequence.length()) {
+            char c = sequence.at(i);
+            if (c == 0x1b && (i + 1) < sequence.length() && sequence.at(i+1) == '[') {
+                size_t j = i + 2;
+                while (j < sequence.length() && (sequence.at(j) < 0x40 || sequence.at(j) > 0x7e))
+                    ++j;
+                if (j < sequence.length() && sequence.at(j) == 'm') {
+                    std::string par = sequence.substr(i + 2, j - i - 2);
+                    if (par.empty() || par == "0")
+                        sgr.clear();
+                    else if (par.compare(0, 2, "0;") == 0)
+                        sgr = sequence.substr(i, j - i + 1);
+                    else
+                        sgr.append(sequence, i, j - i + 1);
+                    attr = attr_index(sgr);
+                }
+                i = j + 1;
+            }
+            else {
+                cell C = { c, attr };
+                cells.push_back(C);
+                ++i;
+            }
+        }
+    }
+
+    void editor::write_cells(const cells_t &cells, size_t from, size_t to)
+    {
+        std::string out;
+        uint16_t attr = 0;
+        for (size_t i = from; i < to; ++i) {
+            const cell &C = cells[i];
+            if (C.attr != attr) {
+                out.append("\x1b[0m");
+                out.append(attrs[C.attr]);
+                attr = C.attr;
+            }
+            out += C.c;
+        }
+        if (attr != 0)
+            out.append("\x1b[0m");
+        driver.write(out.data(), out.length());
+    }
+
     int editor::print()
     {
         state = IDLE;
 
+        // gather all output of this pass into a single write
+        terminal_driver::auto_frame _f_(driver);
+
         if (obj->mode == MODE_MULTILINE) {
             // render prompt (if not already rendered)
             if (obj->prompt_rendered == 0) {
@@ -138,8 +413,9 @@ namespace libchars {
             }
             // print from previous cursor up to current end-of-buffer
             if (obj->cursor < obj->insert_idx) {
-                size_t n_to_write = (obj->insert_idx - obj->cursor);
-                driver.write(obj->data() + obj->cursor, n_to_write);
+                std::string sequence;
+                obj->copy(obj->cursor, obj->insert_idx - obj->cursor, sequence);
+                driver.write(sequence.data(), sequence.length());
                 obj->cursor = obj->insert_idx;
             }
         }
@@ -300,6 +576,8 @@ namespace libchars {
               // start printing in upper-left corner
               terminal_driver::auto_cursor __(driver);
               driver.clear_screen();
+              shadow_obj = NULL;
+              menu.shown = false;
 
               // print partial prompt (if possible)
               if (render_length < window) {
@@ -322,50 +600,295 @@ namespace libchars {
           else {
               LC_LOG_VERBOSE("obj->cursor[%zu]",obj->cursor);
 
-              // move cursor to start of prompt position (relative to current position)
-              if (driver.set_new_xy(0 - (ssize_t)obj->cursor - (ssize_t)obj->prompt_rendered) < 0)
-                  return -1;
+              // cells that must be on screen after this pass: prompt + rendered line
+              std::string sequence;
+              size_t rendered = 0;
+              if (render_length > 0)
+                  rendered = obj->render(0, render_length, sequence);
+              cells_t cells;
+              cells.reserve(obj->prompt.length() + rendered);
+              for (size_t i = 0; i < obj->prompt.length(); ++i) {
+                  cell C = { obj->prompt.at(i), 0 };
+                  cells.push_back(C);
+              }
+              to_cells(sequence, cells);
+
+              if (shadow_obj != obj || (obj->cursor == 0 && obj->prompt_rendered == 0)) {
+                  // fresh line: application output (e.g. printf) might have moved the cursor behind the driver's back
+                  if (obj->cursor == 0 && obj->prompt_rendered == 0)
+                      driver.cursor_invalidate();
+
+                  // move cursor to start of prompt position (relative to current position)
+                  if (driver.set_new_xy(0 - (ssize_t)obj->cursor - (ssize_t)obj->prompt_rendered) < 0)
+                      return -1;
+
+                  // clear area for printing
+                  driver.clear_to_end_of_screen();
+                  menu.shown = false;
+
+                  // render prompt
+                  if (obj->prompt.length() > 0) {
+                      driver.write(obj->prompt.data(), obj->prompt.length());
+                      LC_LOG_VERBOSE("cursor[%zu];prompt_rendered[%zu]",obj->cursor,obj->prompt_rendered);
+                      obj->cursor = 0;
+                  }
+                  obj->prompt_rendered = obj->prompt.length();
+
+                  if (render_length > 0) {
+                      // print line
+                      terminal_driver::auto_cursor __(driver);
+                      if (rendered > 0)
+                          driver.write(sequence.data(), sequence.length());
+                      LC_LOG_VERBOSE("rendered[%zu]",rendered);
 
-              // clear area for printing (TODO: optimize by only clearing specific lines)
-              driver.clear_to_end_of_screen();
+                      // hack to convince cursor to move to the start of the next line
+                      // on a fully populated rendered line
+                      if (((obj->prompt_rendered + rendered) % cols) == 0)
+                          driver.newline();
 
-              // render prompt
-              if (obj->prompt.length() > 0) {
-                  driver.write(obj->prompt.data(), obj->prompt.length());
-                  LC_LOG_VERBOSE("cursor[%zu];prompt_rendered[%zu]",obj->cursor,obj->prompt_rendered);
-                  obj->cursor = 0;
+                      // move to final cursor position (relative to current position)
+                      if (driver.set_new_xy((ssize_t)cursor - (ssize_t)rendered) < 0)
+                          return -1;
+                  }
+
+                  // only track cells if the rendered sequence could be decoded
+                  shadow_obj = (cells.size() == obj->prompt_rendered + rendered) ? obj : NULL;
               }
-              obj->prompt_rendered = obj->prompt.length();
+              else {
+                  // differential update: only rewrite cells [from,to) that differ from the shadow
+                  size_t pos = obj->prompt_rendered + obj->cursor; // relative to start of prompt
+                  size_t target = obj->prompt.length() + ((render_length > 0) ? cursor : 0);
+                  size_t n_old = shadow.size();
+                  size_t n_new = cells.size();
 
-              if (render_length > 0) {
-                  // print line
-                  terminal_driver::auto_cursor __(driver);
-                  size_t rendered = render(0, render_length);
-                  LC_LOG_VERBOSE("rendered[%zu]",rendered);
+                  size_t from = 0;
+                  while (from < n_old && from < n_new && shadow[from] == cells[from])
+                      ++from;
+                  size_t to = n_new;
+                  if (n_old == n_new) {
+                      while (to > from && shadow[to-1] == cells[to-1])
+                          --to;
+                  }
+                  // do not stop in the pending-wrap state in the middle of the line
+                  if (to > from && to < n_new && (to % cols) == 0)
+                      ++to;
 
-                  // hack to convince cursor to move to the start of the next line
-                  // on a fully populated rendered line
-                  if (((obj->prompt_rendered + rendered) % cols) == 0)
-                      driver.newline();
+                  LC_LOG_VERBOSE("pos[%zu];cells[%zu->%zu];update[%zu..%zu];target[%zu]",pos,n_old,n_new,from,to,target);
+
+                  if (to > from || n_new < n_old) {
+                      if (driver.set_new_xy((ssize_t)from - (ssize_t)pos) < 0)
+                          return -1;
+                      write_cells(cells, from, to);
+                      pos = to;
+
+                      // same hack as above: move to next line on a fully populated line
+                      if (to > from && to == n_new && (n_new % cols) == 0)
+                          driver.newline();
+
+                      // remove leftovers of a longer line
+                      if (n_new < n_old) {
+                          driver.clear_to_end_of_screen();
+                          menu.shown = false;
+                      }
+                  }
 
                   // move to final cursor position (relative to current position)
-                  if (driver.set_new_xy((ssize_t)cursor - (ssize_t)rendered) < 0)
+                  if (driver.set_new_xy((ssize_t)target - (ssize_t)pos) < 0)
                       return -1;
+
+                  obj->prompt_rendered = obj->prompt.length();
               }
+
+              shadow.swap(cells);
           }
 
           obj->cursor = (render_length > 0) ? cursor : 0;
 
           if (LC_LOG_CHECK_LEVEL(debug::VERBOSE) && driver.control()) {
               size_t x,y;
+              bool known = driver.cursor_known();
               driver.cursor_position(x,y);
-              LC_LOG_VERBOSE("obj->cursor[%zu];x[%zu],y[%zu]",obj->cursor,x,y);
+              LC_LOG_VERBOSE("obj->cursor[%zu];x[%zu],y[%zu];model[%s]",obj->cursor,x,y,known?"valid":"unknown");
           }
         }
 
         return 0;
     }
 
+    size_t editor::menu_space(size_t lines)
+    {
+        if (obj == NULL || obj->mode != MODE_COMMAND || !driver.control())
+            return 0;
+        size_t cols = driver.columns();
+        size_t rows = driver.rows();
+        if (cols <= 1 || rows == 0)
+            return 0;
+        // rows taken by prompt + line as print() will render it
+        size_t cells = obj->prompt.length() + obj->terminal_idx(obj->idx(obj->length()));
+        size_t used = cells / cols + 1 + lines;
+        return (used < rows) ? (rows - used) : 0;
+    }
+
+    size_t editor::menu_text(const std::string &sequence, size_t limit)
+    {
+        cells_t cells;
+        to_cells(sequence, cells);
+        if (cells.size() > limit)
+            cells.resize(limit);
+        write_cells(cells, 0, cells.size());
+        return cells.size();
+    }
+
+    size_t editor::menu_item(size_t i, std::string &out) const
+    {
+        const std::string &item = menu.items[i];
+        size_t n = std::min(item.length(), menu.width - MENU_GAP);
+        out.append(menu.sgr);
+        if (i == menu.selected)
+            out.append("\x1b[7m");
+        out.append(item, 0, n);
+        out.append("\x1b[0m");
+        return n;
+    }
+
+    size_t editor::menu_capacity(size_t width, size_t lines)
+    {
+        size_t rows = menu_space(lines);
+        if (rows == 0)
+            return std::string::npos;
+        // last column of the terminal is kept clear (no pending wrap)
+        size_t usable = driver.columns() - 1;
+        width = std::max((size_t)1, std::min(width, usable));
+        return std::max((size_t)1, (usable + MENU_GAP) / (width + MENU_GAP)) * rows;
+    }
+
+    int editor::menu_show(const std::string &header, const std::vector<std::string> &items, const std::string &sgr, const std::string &footer, size_t selected)
+    {
+        terminal_driver::auto_frame _f_(driver);
+
+        size_t cols = (driver.columns() > 1) ? driver.columns() : 80;
+        size_t usable = cols - 1;
+        size_t width = 1;
+        for (size_t i = 0; i < items.size(); ++i)
+            width = std::max(width, items[i].length());
+        width = std::min(width, usable);
+        size_t n_cols = std::max((size_t)1, (usable + MENU_GAP) / (width + MENU_GAP));
+        size_t n_rows = (items.size() + n_cols - 1) / n_cols;
+        size_t lines = (header.empty() ? 0 : 1) + (footer.empty() ? 0 : 1);
+
+        // options are placed relative to the line: bring it up to date first
+        bool shown = (n_rows > 0 && menu_space(lines) >= n_rows);
+        if (shown) {
+            print();
+            shown = (shadow_obj == obj);
+        }
+        if (!shown)
+            menu_close();
+
+        menu.items = items;
+        menu.sgr = sgr;
+        menu.width = width + MENU_GAP;
+        menu.n_rows = n_rows;
+        menu.selected = std::min(selected, items.size());
+
+        size_t pos = 0;
+        if (shown) {
+            pos = obj->prompt_rendered + obj->cursor;
+            size_t n = shadow.size();
+            menu.top = (n / cols + 1) * cols;
+            if (menu.shown) {
+                // replace menu on screen
+                if (driver.set_new_xy((ssize_t)menu.top - (ssize_t)pos) < 0)
+                    return -1;
+            }
+            else {
+                // new lines below the line (scroll the screen if needed)
+                if (driver.set_new_xy((ssize_t)n - (ssize_t)pos) < 0)
+                    return -1;
+                driver.newline();
+            }
+            driver.clear_to_end_of_screen();
+            menu.item_top = menu.top + (header.empty() ? 0 : cols);
+        }
+        else {
+            driver.newline();
+        }
+
+        size_t n_lines = lines + n_rows;
+        size_t x = 0; // displayed length of last line written
+        for (size_t l = 0; l < n_lines; ++l) {
+            if (l > 0)
+                driver.newline();
+            size_t r = l - (header.empty() ? 0 : 1);
+            if (!header.empty() && l == 0) {
+                x = menu_text(header, usable);
+            }
+            else if (r < n_rows) {
+                std::string out;
+                x = 0;
+                for (size_t i = r; i < items.size(); i += n_rows) {
+                    size_t column = (i / n_rows) * menu.width;
+                    out.append(column - x, ' ');
+                    x = column + menu_item(i, out);
+                }
+                driver.write(out.data(), out.length());
+            }
+            else {
+                x = menu_text(footer, usable);
+            }
+        }
+
+        menu.shown = shown;
+        if (!shown) {
+            driver.newline();
+            return 1;
+        }
+        // back to the cursor in the line
+        return driver.set_new_xy((ssize_t)pos - (ssize_t)(menu.top + (n_lines - 1) * cols + x));
+    }
+
+    void editor::menu_select(size_t idx)
+    {
+        idx = std::min(idx, menu.items.size());
+        if (!menu.shown || idx == menu.selected)
+            return;
+
+        terminal_driver::auto_frame _f_(driver);
+
+        size_t cols = driver.columns();
+        size_t pos = obj->prompt_rendered + obj->cursor;
+        size_t at = pos;
+        const size_t redraw[2] = { menu.selected, idx };
+        menu.selected = idx;
+        for (size_t k = 0; k < 2; ++k) {
+            size_t i = redraw[k];
+            if (i >= menu.items.size())
+                continue;
+            size_t to = menu.item_top + (i % menu.n_rows) * cols + (i / menu.n_rows) * menu.width;
+            if (driver.set_new_xy((ssize_t)to - (ssize_t)at) < 0)
+                return;
+            std::string out;
+            at = to + menu_item(i, out);
+            driver.write(out.data(), out.length());
+        }
+        driver.set_new_xy((ssize_t)pos - (ssize_t)at);
+    }
+
+    void editor::menu_close()
+    {
+        if (!menu.shown)
+            return;
+        menu.shown = false;
+
+        terminal_driver::auto_frame _f_(driver);
+
+        size_t pos = obj->prompt_rendered + obj->cursor;
+        if (driver.set_new_xy((ssize_t)menu.top - (ssize_t)pos) < 0)
+            return;
+        driver.clear_to_end_of_screen();
+        driver.set_new_xy((ssize_t)pos - (ssize_t)menu.top);
+    }
+
     int editor::edit(edit_object &obj_ref, size_t timeout_s)
     {
         //TODO: remove newlines from prompt (not for multi-line mode)
@@ -382,12 +905,32 @@ namespace libchars {
         while ((r = driver.read(c,timeout_s)) >= 0) {
             if (driver.size_changed() && obj->mode == MODE_COMMAND) {
                 // clear screen because position is not reliable after terminal size update
-                driver.clear_screen();
+                terminal_driver::auto_frame _f_(driver);
+                clear_screen();
                 obj->prompt_rendered = 0;
                 print();
             }
             if (r > 0) {
                 k = decode_key(c);
+                if (menu.shown) {
+                    switch (k) {
+                    case KEY_LEFT:
+                    case KEY_RIGHT:
+                        // move in the menu
+                        print();
+                        return 0;
+                    case KEY_UP: case KEY_DOWN:
+                    case KEY_PGUP: case KEY_PGDN:
+                    case KEY_TAB: case KEY_ENTER:
+                    case PARTIAL_SEQ: case IGNORE_SEQ:
+                    case SEQ_TIMEOUT: case FORCED_RET:
+                        break;
+                    default:
+                        // editing goes on in the line
+                        menu_close();
+                        break;
+                    }
+                }
                 switch (k) {
                 case PRINTABLE_CHAR:
                     obj->insert(c);
@@ -413,8 +956,9 @@ namespace libchars {
                     break;
                 case KEY_CLEAR:
                     if (obj->mode == MODE_COMMAND && driver.control()) {
+                        terminal_driver::auto_frame _f_(driver);
                         obj->rewind();
-                        driver.clear_screen();
+                        clear_screen();
                         print();
                     }
                     break;
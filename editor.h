@@ -28,6 +28,7 @@ SOFTWARE.
 #include "terminal.h"
 
 #include <string>
+#include <vector>
 
 namespace libchars {
 
@@ -58,8 +59,13 @@ namespace libchars {
     class edit_object
     {
     private:
-        const static size_t MAX_LINE = 16384;
-        char buffer[MAX_LINE];
+        // gap buffer: [0,gap_start) + gap + [gap_end,bufsize); gap moves to the
+        // edit position, so consecutive edits at the cursor do not move the tail
+        const static size_t MIN_CAPACITY = 64;
+        char *buffer;
+        size_t bufsize;
+        mutable size_t gap_start;
+        mutable size_t gap_end;
         size_t buflen;
     public:
         const mode_e mode;
@@ -68,49 +74,48 @@ namespace libchars {
         size_t cursor;
         size_t prompt_rendered;
     private:
+        edit_object(edit_object const&);
+        void operator=(edit_object const&);
+
         void reset() {
             rewind();
             insert_idx = buflen;
         }
+
+        void assign(const char *s, size_t n);
+        bool reserve(size_t n);
+        void move_gap(size_t pos) const;
+
+        static void secure_zero(char *p, size_t n) {
+            volatile char *v = p;
+            while (n-- > 0)
+                *v++ = 0;
+        }
+        inline char &ref(size_t idx) { return (idx < gap_start) ? buffer[idx] : buffer[idx + gap_end - gap_start]; }
     public:
-        edit_object(mode_e m = MODE_STRING, const char *s = NULL) : mode(m) {
-            if (s != NULL) {
-                strncpy(buffer,s,sizeof(buffer)-1);
-                buffer[sizeof(buffer) - 1] = 0;
-                buflen = strlen(buffer);
-            }
-            else {
-                memset(buffer, 0, sizeof(buffer));
-                buflen = 0;
-            }
+        edit_object(mode_e m = MODE_STRING, const char *s = NULL) :
+            buffer(NULL),bufsize(0),gap_start(0),gap_end(0),buflen(0),mode(m) {
+            assign(s, (s != NULL) ? strlen(s) : 0);
             reset();
         }
-        edit_object(mode_e m, std::string &s) : mode(m) { 
-            if (!s.empty()) {
-                strncpy(buffer,s.c_str(),sizeof(buffer)-1);
-                buffer[sizeof(buffer) - 1] = 0;
-                buflen = strlen(buffer);
-            }
-            else {
-                memset(buffer, 0, sizeof(buffer));
-                buflen = 0;
-            }
+        edit_object(mode_e m, std::string &s) :
+            buffer(NULL),bufsize(0),gap_start(0),gap_end(0),buflen(0),mode(m) {
+            assign(s.c_str(), strlen(s.c_str()));
             reset();
         }
         virtual ~edit_object() {
-            // securely wipe contents of buffer
-            if (buflen > 0) {
-                volatile char *p = buffer + buflen - 1;
-                while (buflen > 0) {
-                    *p-- = 0;
-                    --buflen;
-                }
+            // securely wipe contents of buffer (including stale bytes in the gap)
+            if (buffer != NULL) {
+                secure_zero(buffer, bufsize);
+                delete[] buffer;
             }
+            buflen = 0;
         }
 
-        inline const char *data() const { return buffer; }
+        const char *data() const; // contiguous + zero-terminated; moves gap to the end (not for every keystroke)
+        void copy(size_t idx, size_t n, std::string &out) const; // append [idx,idx+n) to 'out'; gap not moved
         inline size_t length() const { return buflen; }
-        inline char at(size_t idx) const { return *(buffer + idx); }
+        inline char at(size_t idx) const { return (idx < gap_start) ? buffer[idx] : buffer[idx + gap_end - gap_start]; }
         inline size_t idx(size_t idx_in) { return idx_in > buflen ? buflen : idx_in;}
         inline void rewind() { cursor = 0; prompt_rendered = 0; }
         inline void clear() { insert_idx = 0; wipe(); reset(); }
@@ -121,9 +126,7 @@ namespace libchars {
         {
             if (line != NULL) {
                 size_t L = buflen;
-                strncpy(buffer,line,sizeof(buffer)-1);
-                buffer[sizeof(buffer) - 1] = 0;
-                buflen = strlen(buffer);
+                assign(line, strlen(line));
 
                 if (idx <= buflen)
                     insert_idx = idx;
@@ -141,12 +144,11 @@ namespace libchars {
 
         virtual void insert(const char c)
         {
-            if (buflen < (MAX_LINE-1)) {
-                if (insert_idx < buflen) {
-                    memmove(buffer+insert_idx+1, buffer+insert_idx, buflen-insert_idx);
-                }
-                volatile char *p = buffer + insert_idx;
+            if (insert_idx <= buflen && reserve(1)) {
+                move_gap(insert_idx);
+                volatile char *p = buffer + gap_start;
                 *p = c;
+                ++gap_start;
                 ++insert_idx;
                 ++buflen;
             }
@@ -155,11 +157,10 @@ namespace libchars {
         virtual void wipe()
         {
             if (buflen > insert_idx) {
-                volatile char *p = buffer + buflen - 1;
-                while (buflen > insert_idx) {
-                    *p-- = 0;
-                    --buflen;
-                }
+                move_gap(insert_idx);
+                secure_zero(buffer + gap_end, bufsize - gap_end);
+                gap_end = bufsize;
+                buflen = insert_idx;
                 if (buflen == 0)
                     emptied();
             }
@@ -169,11 +170,10 @@ namespace libchars {
         {
             size_t L = buflen;
             if (insert_idx < buflen) {
-                if (insert_idx < (buflen-1)) {
-                    memmove(buffer+insert_idx, buffer+insert_idx+1, buflen-1-insert_idx);
-                }
-                volatile char *p = buffer + buflen - 1;
+                move_gap(insert_idx);
+                volatile char *p = buffer + gap_end;
                 *p = 0;
+                ++gap_end;
                 --buflen;
             }
             if (L > 0 && buflen == 0)
@@ -194,9 +194,9 @@ namespace libchars {
                 size_t swap_idx = insert_idx;
                 if (swap_idx == buflen)
                     --swap_idx;
-                char c = *(buffer + swap_idx);
-                *(buffer + swap_idx) = *(buffer + swap_idx - 1);
-                *(buffer + swap_idx - 1) = c;
+                char c = ref(swap_idx);
+                ref(swap_idx) = ref(swap_idx - 1);
+                ref(swap_idx - 1) = c;
                 if (insert_idx < buflen)
                     right();
             }
@@ -230,10 +230,9 @@ namespace libchars {
         {
             //NOTE: return number of *displayed* characters, which might
             // be different from sequence.length() (e.g. if color used)
-            if (limit > 0 && buf_idx < buflen) 
-                sequence.assign(buffer, buflen-buf_idx);
-            else 
-                sequence.clear();
+            sequence.clear();
+            if (limit > 0 && buf_idx < buflen)
+                copy(buf_idx, buflen-buf_idx, sequence);
             return sequence.length();
         }
 
@@ -277,13 +276,43 @@ namespace libchars {
         edit_object *obj;
         enum { IDLE, RENDER_DEFER, RENDER_NOW } state;
         key_e k;
-        //- - - -
+        //- - - - input parser state
         const static size_t MAX_DECODE_SEQUENCE = 16;
-        uint8_t seq[MAX_DECODE_SEQUENCE];
+        uint8_t seq[MAX_DECODE_SEQUENCE]; // raw bytes of current sequence (debug logs)
         size_t seq_N;
+        uint8_t p_state;
+        const static size_t MAX_DECODE_PARAMS = 16;
+        uint16_t par[MAX_DECODE_PARAMS];
+        size_t par_N;
+        uint8_t p_collect; // private marker / intermediate character
+        //- - - - shadow of cells on screen (prompt + rendered line); used for differential rendering
+        struct cell {
+            char c;
+            uint16_t attr; // index into 'attrs'; 0 = normal
+            bool operator==(const cell &o) const { return c == o.c && attr == o.attr; }
+        };
+        typedef std::vector<cell> cells_t;
+        cells_t shadow;
+        std::vector<std::string> attrs; // interned SGR sequences
+        const edit_object *shadow_obj;
+        //- - - - menu of options on the lines below the edited line; positions
+        // are offsets (in cells) from the start of the prompt, so that they
+        // survive the screen scrolling up
+        struct menu_state {
+            std::vector<std::string> items; // page shown
+            std::string sgr; // attributes of an item (selected item: reverse video added)
+            size_t width; // of a column, including the gap to the next one
+            size_t n_rows; // rows of items; filled column by column
+            size_t top; // first line below the edited line
+            size_t item_top; // first row of items
+            size_t selected; // items.size() if none
+            bool shown; // on screen; navigation keys are returned to the caller
+            menu_state() : width(0),n_rows(0),top(0),item_top(0),selected(0),shown(false) {}
+        };
+        menu_state menu;
 
     public:
-        editor(terminal_driver &d) : driver(d),obj(NULL),state(IDLE),seq_N(0) {}
+        editor(terminal_driver &d) : driver(d),obj(NULL),state(IDLE),seq_N(0),p_state(0),par_N(0),p_collect(0),attrs(1),shadow_obj(NULL) {}
 
     private:
         key_e decode_key(uint8_t c);
@@ -294,6 +323,14 @@ namespace libchars {
         size_t render(size_t buf_idx, size_t length);
         int print();
 
+        uint16_t attr_index(const std::string &sgr);
+        void to_cells(const std::string &sequence, cells_t &cells);
+        void write_cells(const cells_t &cells, size_t from, size_t to);
+
+        size_t menu_space(size_t lines); // rows for items below the line + 'lines'; 0 if menu can only be printed
+        size_t menu_text(const std::string &sequence, size_t limit);
+        size_t menu_item(size_t i, std::string &out) const;
+
     public:
         int edit(edit_object &obj_ref, size_t timeout_s = 0);
         int edit(std::string &str, size_t timeout_s = 0);
@@ -302,12 +339,30 @@ namespace libchars {
         inline bool control() const { return driver.control(); }
 
         inline void newline() { driver.newline(); }
-        inline void clear_screen() { driver.clear_screen(); }
+        inline void clear_screen() { driver.clear_screen(); shadow_obj = NULL; menu.shown = false; } // next print() redraws prompt + line in full
+
+        inline void begin_frame() { driver.begin_frame(); }
+        inline int end_frame() { return driver.end_frame(); }
 
         inline void set_return_timeout(size_t timeout_s) { driver.set_return_timeout(timeout_s); }
         inline void clear_return_timeout() { driver.clear_return_timeout(); }
 
         inline key_e key() { return k; } // key that triggered return in edit()
+
+        // menu of options below the edited line (e.g. completions), laid out
+        // in columns to the width of the terminal; while it is shown, edit()
+        // returns on navigation keys (arrows, page up/down, TAB, enter) and
+        // closes it on any other key
+        const static size_t MENU_GAP = 2; // spaces between columns
+
+        size_t menu_capacity(size_t width, size_t lines); // items of 'width' on one page, with 'lines' of header/footer; npos if only printed (no room/control)
+        int menu_show(const std::string &header, const std::vector<std::string> &items, const std::string &sgr, const std::string &footer, size_t selected); // 0: shown; 1: printed (line must be redrawn)
+        void menu_select(size_t idx); // only rewrites the items (de)selected
+        void menu_close();
+
+        inline bool menu_shown() const { return menu.shown; }
+        inline size_t menu_rows() const { return menu.n_rows; }
+        inline size_t menu_selected() const { return menu.selected; } // >= number of items if none
     };
 
 }
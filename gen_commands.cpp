@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// build-time generator of the compiled-in command snapshot: the command
+// definitions of sample_commands.h are added to a command set, and the
+// snapshot of the set is written as C++ source (see CMakeLists.txt)
+//
+// usage: gen_commands <output.cpp>
+
+#include "sample_commands.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output.cpp>\n", argv[0]);
+        return 2;
+    }
+
+    command_set C_set;
+    if (!C_set.add(__sample_commands, sizeof(__sample_commands) / sizeof(__sample_commands[0]))) {
+        fprintf(stderr, "%s: command definitions not valid\n", argv[0]);
+        return 1;
+    }
+    if (!C_set.save_source(argv[1], "sample_commands_image", SAMPLE_COMMANDS_HASH)) {
+        fprintf(stderr, "%s: could not write %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    return 0;
+}
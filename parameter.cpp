@@ -31,6 +31,7 @@ namespace libchars {
           ttype(ttype_),ID(ID_),
           status(0),vtype(vtype_),
           offset(0),length(0),
+          checked_vtype(validator::NONE),checked(validator::INVALID),
           next(NULL)
     {
         if (name_ != NULL)
@@ -78,6 +79,206 @@ namespace libchars {
     }
 
 
+    struct parameter_name_order
+    {
+        const parameters_t &par;
+        parameter_name_order(const parameters_t &p) : par(p) {}
+        bool operator()(parameter_names::index_t a, parameter_names::index_t b) const { return par[a].name < par[b].name; }
+    };
+
+    parameter_names::parameter_names(const parameters_t &parameters)
+    {
+        for (size_t p_idx = 0; p_idx < parameters.size(); ++p_idx) {
+            const parameter &P = parameters[p_idx];
+            if ((P.ttype == token::FLAG || P.ttype == token::KEY) && !(P.status & token::HIDDEN) && !P.name.empty())
+                par.push_back((index_t)p_idx);
+        }
+        std::sort(par.begin(), par.end(), parameter_name_order(parameters));
+        sorted.reserve(par.size());
+        for (size_t i = 0; i < par.size(); ++i)
+            sorted.push_back(parameters[par[i]].name);
+
+        nodes.resize(1);
+        build(0, 0, (index_t)sorted.size(), 0);
+    }
+
+    void parameter_names::build(index_t n, index_t lo, index_t hi, index_t depth)
+    {
+        // label: common prefix of the names in [lo,hi) (sorted: first vs last)
+        index_t to = depth;
+        if (lo < hi) {
+            const std::string &a = sorted[lo];
+            const std::string &b = sorted[hi - 1];
+            while (to < a.length() && to < b.length() && a[to] == b[to])
+                ++to;
+        }
+        nodes[n].from = depth;
+        nodes[n].to = to;
+        nodes[n].lo = lo;
+        nodes[n].hi = hi;
+        nodes[n].child = NONE;
+        nodes[n].map = NONE;
+
+        // children: one per next character (names ending here sort first)
+        index_t i = lo;
+        while (i < hi && sorted[i].length() == to)
+            ++i;
+        if (i == hi)
+            return;
+        first_char_map map;
+        index_t n_children = 0;
+        for (index_t j = i; j < hi; ++j) {
+            if (!map.test(sorted[j][to])) {
+                map.set(sorted[j][to]);
+                ++n_children;
+            }
+        }
+        index_t child = (index_t)nodes.size();
+        nodes.resize(child + n_children);
+        nodes[n].child = child;
+        nodes[n].map = (index_t)maps.size();
+        maps.push_back(map);
+        while (i < hi) {
+            index_t j = i + 1;
+            while (j < hi && sorted[j][to] == sorted[i][to])
+                ++j;
+            build(child++, i, j, to);
+            i = j;
+        }
+    }
+
+    bool parameter_names::find(const char *prefix, size_t length, size_t &lo, size_t &hi) const
+    {
+        if (sorted.empty())
+            return false;
+        index_t n = 0;
+        size_t pos = 0;
+        while (true) {
+            const node &N = nodes[n];
+            const std::string &label = sorted[N.lo];
+            for (index_t i = N.from; i < N.to && pos < length; ++i, ++pos) {
+                if (label[i] != prefix[pos])
+                    return false;
+            }
+            if (pos == length) {
+                lo = N.lo;
+                hi = N.hi;
+                return true;
+            }
+            if (N.map == NONE || !maps[N.map].test(prefix[pos]))
+                return false;
+            n = N.child + maps[N.map].rank(prefix[pos]);
+        }
+    }
+
+    size_t parameter_names::available(size_t lo, size_t hi, const mask_t &given, size_t &first, size_t &last) const
+    {
+        size_t count = 0;
+        first = last = hi;
+        for (size_t w = lo / 64; w * 64 < hi; ++w) {
+            uint64_t bits = ~given[w];
+            if (w == lo / 64)
+                bits &= ~(uint64_t)0 << (lo % 64);
+            if ((w + 1) * 64 > hi)
+                bits &= ~(~(uint64_t)0 << (hi % 64));
+            if (bits == 0)
+                continue;
+            if (first == hi)
+                first = w * 64 + __builtin_ctzll(bits);
+            last = w * 64 + 63 - __builtin_clzll(bits);
+            count += __builtin_popcountll(bits);
+        }
+        return count;
+    }
+
+    bool commands::given_parameters(const token *until, parameter_names::mask_t &given) const
+    {
+        // FLAG/KEY names on the line before 'until' (NULL: whole line), as
+        // typed; true if the word at 'until' is the value of a KEY
+        const parameter_names &names = cmd->names();
+        names.clear(given);
+        const char *line = data();
+        bool value = false;
+        for (const token *T = t_par; T != NULL && T != until && (T->status & token::IN_STRING); T = T->next) {
+            if (value || (T->status & token::IS_QUOTED)) {
+                value = false;
+                continue;
+            }
+            size_t lo, hi;
+            if (!names.find(line + T->offset, T->length, lo, hi))
+                continue;
+            for (size_t i = lo; i < hi && names.name(i).length() == T->length; ++i) {
+                names.give(given, i);
+                value = (cmd->par[names.par_idx(i)].ttype == token::KEY);
+            }
+        }
+        return value;
+    }
+
+    void commands::complete_parameter(token *Tcur, size_t t_offset)
+    {
+        // not a command word: complete the FLAG/KEY names of the command
+        // that are not on the line yet (word at the cursor or a new word)
+        if (cmd == NULL)
+            return;
+        if (Tcur != NULL) {
+            const token *T = t_par;
+            while (T != NULL && T != Tcur)
+                T = T->next;
+            if (T == NULL)
+                return;
+        }
+
+        parameter_names::mask_t given;
+        if (given_parameters(Tcur, given)) {
+            LC_LOG_DEBUG("** value of key expected **");
+            return;
+        }
+        const parameter_names &names = cmd->names();
+        std::string word;
+        if (Tcur != NULL)
+            word.assign(data() + Tcur->offset, t_offset);
+        size_t before = (Tcur != NULL) ? Tcur->offset : length();
+        size_t lo, hi, first, last;
+        size_t n = names.find(word.data(), word.length(), lo, hi) ? names.available(lo, hi, given, first, last) : 0;
+        LC_LOG_VERBOSE("parameter [%s]: %zu name(s)",word.c_str(),n);
+        if (n == 0)
+            return;
+
+        // common part of the names (sorted: first vs last)
+        const std::string &a = names.name(first);
+        const std::string &b = names.name(last);
+        size_t common = word.length();
+        while (common < a.length() && common < b.length() && a[common] == b[common])
+            ++common;
+
+        if (n == 1 && common == word.length()) {
+            // end-of-word --> add space
+            if (Tcur != NULL)
+                insert(' ');
+        }
+        else if (common > word.length()) {
+            for (size_t i = word.length(); i < common; ++i)
+                insert(a[i]);
+            parse();
+        }
+        else {
+            menu.names.clear();
+            for (size_t i = first; i <= last; ++i) {
+                if (!names.is_given(given, i))
+                    menu.names.push_back(names.name(i));
+            }
+            menu.first.assign(1, 0);
+            menu.before.assign(data(), before);
+            menu.word = word;
+            menu.n = n;
+            menu.exact = true;
+            menu.cr = false;
+            show_menu(0, std::string::npos);
+        }
+    }
+
+
     commands::status_t commands::sort()
     {
         if (cmd == NULL)
@@ -87,7 +288,8 @@ namespace libchars {
         size_t n_assigned = 0;
         size_t n_available = 0;
         token *T = NULL;
-        parameters_t par = cmd->par;
+        const parameters_t &par = cmd->par; // shared by all sessions; read-only
+        std::vector<bool> used(par.size(), false); // parameter assigned to a token
 
         // find FLAG parameters
         T = t_par;
@@ -95,8 +297,8 @@ namespace libchars {
             ++n_available;
             if ((T->status & (token::IS_QUOTED | token::SORTED)) == 0) {
                 for (p_idx = 0; p_idx < par.size(); ++p_idx) {
-                    parameter &P = par[p_idx];
-                    if (!(P.status & token::SORTED) && P.ttype == token::FLAG) {
+                    const parameter &P = par[p_idx];
+                    if (!used[p_idx] && P.ttype == token::FLAG) {
                         if (P.name == T->value) {
                             // full match on flag name
                             T->status |= (token::SORTED | token::IN_STRING);
@@ -104,7 +306,7 @@ namespace libchars {
                             T->name = P.name;
                             T->ID = P.ID;
                             T->value.clear();
-                            P.status |= token::SORTED;
+                            used[p_idx] = true;
                             ++n_assigned;
                             break;
                         }
@@ -123,8 +325,8 @@ namespace libchars {
         while (T != NULL) {
             if ((T->status & (token::IS_QUOTED | token::SORTED)) == 0) {
                 for (p_idx = 0; p_idx < par.size(); ++p_idx) {
-                    parameter &P = par[p_idx];
-                    if (!(P.status & token::SORTED) && P.ttype == token::KEY) {
+                    const parameter &P = par[p_idx];
+                    if (!used[p_idx] && P.ttype == token::KEY) {
                         if (P.name == T->value) {
                             // full match on key name
                             T->status &= ~token::PARTIAL_ARG;
@@ -150,7 +352,7 @@ namespace libchars {
                                 T->name = P.name;
                                 T->ID = P.ID;
                                 T->vtype = P.vtype;
-                                P.status |= token::SORTED;
+                                used[p_idx] = true;
                                 n_assigned += 2;
                                 break;
                             }
@@ -168,10 +370,10 @@ namespace libchars {
         // make sure all mandatory KEY parameters were specified
         size_t n_pm = 0, n_po = 0;
         for (p_idx = 0; p_idx < par.size(); ++p_idx) {
-            parameter &P = par[p_idx];
+            const parameter &P = par[p_idx];
             switch (P.ttype) {
             case token::KEY:
-                if ((P.status & (token::SORTED | token::MANDATORY)) == token::MANDATORY) {
+                if (!used[p_idx] && (P.status & token::MANDATORY)) {
                     LC_LOG_VERBOSE("KEY(%s): missing key", P.name.c_str());
                     return TOO_FEW_ARGS;
                 }
@@ -197,16 +399,16 @@ namespace libchars {
                 T = T->next;
             if (T == NULL)
                 break;
-            while (p_idx < par.size() && ((par[p_idx].status & token::SORTED) || par[p_idx].ttype != token::VALUE))
+            while (p_idx < par.size() && (used[p_idx] || par[p_idx].ttype != token::VALUE))
                 ++p_idx;
             if (p_idx >= par.size())
                 break;
-            parameter& P = par[p_idx];
+            const parameter &P = par[p_idx];
             T->status |= (token::SORTED | token::IN_STRING | token::IS_VALUE);
             T->ttype = token::VALUE;
             T->vtype = P.vtype;
             T->ID = P.ID;
-            P.status |= token::SORTED;
+            used[p_idx] = true;
             --n_arguments;
             if (P.status & token::MANDATORY) --n_pm; else --n_po;
         }
@@ -240,8 +442,8 @@ namespace libchars {
 
         if (t_head != NULL) {
             for (p_idx = 0; p_idx < par.size(); ++p_idx) {
-                parameter &P = par[p_idx];
-                if ((P.status & (token::SORTED | token::DEFAULT_SET)) == token::DEFAULT_SET) {
+                const parameter &P = par[p_idx];
+                if (!used[p_idx] && (P.status & token::DEFAULT_SET)) {
                     switch (P.ttype) {
                     case token::FLAG:
                         // missing flag = FALSE
@@ -290,12 +492,19 @@ namespace libchars {
         }
         else {
             size_t parameters_printed = 0;
-            parameters_t &par = cmd->par;
+            const parameters_t &par = cmd->par;
             size_t p_idx;
+            // names already on the line are not listed again
+            const parameter_names &names = cmd->names();
+            parameter_names::mask_t given;
+            (void)given_parameters(NULL, given);
+            std::vector<bool> skip(par.size(), false);
+            for (size_t i = 0; i < names.size(); ++i)
+                skip[names.par_idx(i)] = names.is_given(given, i);
             // {key,value} pairs
             for (p_idx = 0; p_idx < par.size(); ++p_idx) {
-                parameter &P = par[p_idx];
-                if (P.ttype == token::KEY && !(P.status & token::HIDDEN)) {
+                const parameter &P = par[p_idx];
+                if (P.ttype == token::KEY && !(P.status & token::HIDDEN) && !skip[p_idx]) {
                     bool mandatory = (P.status & token::MANDATORY);
                     printf("%c%s%c = <arg>",mandatory?'<':'[',P.name.c_str(),mandatory?'>':']');
                     if (!P.help.empty())
@@ -309,7 +518,7 @@ namespace libchars {
             // positional arguments
             size_t argidx = 1;
             for (p_idx = 0; p_idx < par.size(); ++p_idx) {
-                parameter &P = par[p_idx];
+                const parameter &P = par[p_idx];
                 if (P.ttype == token::VALUE && !(P.status & token::HIDDEN)) {
                     bool mandatory = (P.status & token::MANDATORY);
                     printf("%carg%zu%c",mandatory?'<':'[',argidx++,mandatory?'>':']');
@@ -324,8 +533,8 @@ namespace libchars {
             // flags
             bool type_seen = false;
             for (p_idx = 0; p_idx < par.size(); ++p_idx) {
-                parameter &P = par[p_idx];
-                if (P.ttype == token::FLAG && !(P.status & token::HIDDEN)) {
+                const parameter &P = par[p_idx];
+                if (P.ttype == token::FLAG && !(P.status & token::HIDDEN) && !skip[p_idx]) {
                     if (!type_seen) {
                         type_seen = true;
                         printf("====== optional flags ======\n");
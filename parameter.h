@@ -70,6 +70,9 @@ namespace libchars {
         size_t offset; // index into command string (if applicable)
         size_t length; // length of token in command string (if applicable)
 
+        validator::id_t checked_vtype; // validator that gave 'checked' for this value; NONE if not checked yet
+        validator::status_t checked; // kept while the incremental lexer keeps the token
+
         struct token *next; // next element in linked-list
         //- - - - - - - - - - - - - - - - - - -
 
@@ -0,0 +1,62 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// command definitions of the compiled-in snapshot sample: gen_commands turns
+// them into snapshot source at build time, test_image uses that snapshot
+
+#ifndef __LIBCHARS_SAMPLE_COMMANDS_H__
+#define __LIBCHARS_SAMPLE_COMMANDS_H__
+
+#include "commands.h"
+
+using namespace libchars;
+
+// identifies the definitions below; change it whenever they change, so that
+// a snapshot of other definitions is never used
+#define SAMPLE_COMMANDS_HASH 0x0000000100000016ULL
+
+static const parameter_def __p_show_interface[] = {
+    { token::FLAG, 1, "verbose", validator::NONE, NULL, "More detail", 0 },
+    { token::KEY, 2, "count", validator::NONE, "10", "Number of entries", 0 },
+    { token::VALUE, 3, NULL, validator::NONE, NULL, "Interface name", token::MANDATORY },
+};
+
+static const parameter_def __p_set_interface[] = {
+    { token::VALUE, 3, NULL, validator::NONE, NULL, "Interface name", token::MANDATORY },
+    { token::KEY, 4, "mtu", validator::NONE, NULL, "Maximum transmission unit", token::MANDATORY },
+    { token::KEY, 5, "secret", validator::NONE, "x", "Hidden key", token::HIDDEN },
+};
+
+static const command_def __sample_commands[] = {
+    { "show interface", "show_if", 10, 0x1, false, "Show interface", LC_PARAMETERS(__p_show_interface) },
+    { "show version", "show_ver", 11, 0x1, false, "Show version", LC_NO_PARAMETERS },
+    { "set interface", "set_if", 12, 0x2, false, "Set interface", LC_PARAMETERS(__p_set_interface) },
+    { "debug dump", "dump", 13, 0x1, true, "Dump internal state", LC_NO_PARAMETERS },
+    { "exit", NULL, 14, command::UNLOCK_ALL, false, "Exit", LC_NO_PARAMETERS },
+};
+
+// snapshot source written by gen_commands (see command_dictionary::save_source())
+extern const unsigned char sample_commands_image[];
+extern const size_t sample_commands_image_size;
+
+#endif
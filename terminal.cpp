@@ -32,6 +32,7 @@ SOFTWARE.
 
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
 #include <new>
 
@@ -40,6 +41,7 @@ namespace libchars {
     const static uint64_t LC_WINDOW_SIZE_UPDATE_TIMEOUT_ms = 400;
     const static uint64_t LC_CONTROL_CHECK_TIMEOUT_ms = 2000;
     const static uint64_t LC_CURSOR_POSITION_READ_TIMEOUT_ms = 5000;
+    const static size_t LC_OUTPUT_WRITEV_THRESHOLD = 2048;
 
     terminal_driver::terminal_driver() :
         T_must_return_ms(0),
@@ -51,9 +53,14 @@ namespace libchars {
         control_enabled(false),
         t_cols(0),t_rows(0),
         pos_x(0),pos_y(0),
+        pos_valid(false),pos_wrap(false),
+        save_x(0),save_y(0),
+        save_valid(false),save_wrap(false),
+        out_state(OUT_GROUND),out_npar(0),
         rbuf(NULL),
         rbuf_size_log2(0),rbuf_size(0),
-        rbuf_enq(0),rbuf_deq(0)
+        rbuf_enq(0),rbuf_deq(0),
+        frame_depth(0),n_writes(0)
     {
         T_ws_updated.tv_sec = 0;
         T_ws_updated.tv_usec = 0;
@@ -103,6 +110,8 @@ namespace libchars {
 
     void terminal_driver::shutdown()
     {
+        frame_depth = 0;
+        flush();
         if (fd_r >= 0) {
             const char *term_tty_name = is_tty ? ttyname(fd_r) : "-";
             LC_LOG_DEBUG("RESTORE:%s",term_tty_name);
@@ -153,6 +162,9 @@ namespace libchars {
 
     int terminal_driver::read_characters(bool skip_force_check)
     {
+        // never wait for input while output is still pending
+        flush();
+
         while (true) {
             struct timeval T_now;
             if (gettimeofday(&T_now, NULL) == 0) {
@@ -244,6 +256,7 @@ namespace libchars {
                     if (t_cols != ws.ws_col || t_rows != ws.ws_row) {
                         LC_LOG_VERBOSE("window[%zux%zu]-->[%ux%u]",t_cols,t_rows,ws.ws_col,ws.ws_row);
                         changed = (t_cols != 0 || t_rows != 0);
+                        pos_valid = false; // terminal might have reflowed the screen
                         t_cols = ws.ws_col;
                         t_rows = ws.ws_row;
                     }
@@ -321,6 +334,10 @@ namespace libchars {
                                 ++rbuf_copy_from;
                             }
                             rbuf_enq -= (rbuf_search - rbuf_found);
+                            pos_x = x;
+                            pos_y = y;
+                            pos_valid = true;
+                            pos_wrap = false;
                             return 0;
                         }
                         else if (isdigit(c)) {
@@ -446,9 +463,12 @@ namespace libchars {
         int r = 0;
 
         if (N != 0) {
-            // (x0,y0) = current cursor position
+            // (x0,y0) = current cursor position; only ask the terminal if the screen model lost track
             size_t x0,y0;
-            cursor_position(x0,y0);
+            if (!pos_valid)
+                cursor_position(x0,y0);
+            x0 = pos_x;
+            y0 = pos_y;
 
             // sanity check on (x0,y0) -- some terminal report wrong size
             if (y0 > rows()) {
@@ -463,6 +483,8 @@ namespace libchars {
             }
             else {
                 size_t idx_x0y0 = (y0-1) * t_cols + (x0-1);
+                if (pos_wrap)
+                    ++idx_x0y0; // cursor logically on start of next line
                 if (((ssize_t)idx_x0y0 + N) <= 0) {
                     x1 = 1; y1 = 1;
                     LC_LOG_VERBOSE("x0[%zu];y0[%zu];idx0[%zu] --> TOP-LEFT x1[%zu];y1[%zu]",x0,y0,idx_x0y0,x1,y1);
@@ -504,11 +526,12 @@ namespace libchars {
         return changed_;
     }
 
-    int terminal_driver::write(const char *sequence, size_t seqlen)
+    int terminal_driver::write__(const char *sequence, size_t seqlen)
     {
         const char *const seqend = sequence + seqlen;
 
         while (sequence < seqend) {
+            ++n_writes;
             ssize_t n = ::write(fd_w, sequence, (size_t)(seqend - sequence));
             if (n > 0) {
                 sequence += n;
@@ -523,6 +546,212 @@ namespace libchars {
         return 0;
     }
 
+    int terminal_driver::writev__(const char *sequence, size_t seqlen)
+    {
+        // pending output + large payload in one system call, without copying the payload
+        struct iovec iov[2];
+        iov[0].iov_base = (void *)obuf.data();
+        iov[0].iov_len = obuf.length();
+        iov[1].iov_base = (void *)sequence;
+        iov[1].iov_len = seqlen;
+
+        int iov_idx = 0;
+        while (iov_idx < 2) {
+            ++n_writes;
+            ssize_t n = ::writev(fd_w, iov + iov_idx, 2 - iov_idx);
+            if (n > 0) {
+                while (iov_idx < 2 && (size_t)n >= iov[iov_idx].iov_len) {
+                    n -= iov[iov_idx].iov_len;
+                    ++iov_idx;
+                }
+                if (iov_idx < 2) {
+                    iov[iov_idx].iov_base = (char *)iov[iov_idx].iov_base + n;
+                    iov[iov_idx].iov_len -= n;
+                }
+            }
+            else {
+                if (n == 0 || (errno != EINTR && errno != EWOULDBLOCK)) {
+                    obuf.clear();
+                    return -1;
+                }
+            }
+        }
+        obuf.clear();
+        return 0;
+    }
+
+    int terminal_driver::write(const char *sequence, size_t seqlen)
+    {
+        if (seqlen == 0)
+            return 0;
+
+        track(sequence, seqlen);
+
+        if (frame_depth == 0) {
+            if (!obuf.empty() && flush() != 0)
+                return -1;
+            return write__(sequence, seqlen);
+        }
+
+        if (seqlen >= LC_OUTPUT_WRITEV_THRESHOLD)
+            return writev__(sequence, seqlen);
+
+        obuf.append(sequence, seqlen);
+        return 0;
+    }
+
+    void terminal_driver::line_feed()
+    {
+        // bottom line: terminal scrolls, cursor stays on last line
+        if (pos_y < t_rows)
+            ++pos_y;
+    }
+
+    void terminal_driver::track_csi(char final)
+    {
+        size_t p0 = (out_npar > 0) ? out_par[0] : 0;
+        size_t p1 = (out_npar > 1) ? out_par[1] : 0;
+        size_t n = (p0 > 0) ? p0 : 1;
+
+        switch (final) {
+        case 'A': pos_y = (pos_y > n) ? pos_y - n : 1; break;
+        case 'B': pos_y = ((pos_y + n) < t_rows) ? pos_y + n : t_rows; break;
+        case 'C': pos_x = ((pos_x + n) < t_cols) ? pos_x + n : t_cols; break;
+        case 'D': pos_x = (pos_x > n) ? pos_x - n : 1; break;
+        case 'G': pos_x = (n < t_cols) ? n : t_cols; break;
+        case 'd': pos_y = (n < t_rows) ? n : t_rows; break;
+        case 'H':
+        case 'f':
+            pos_y = (p0 == 0) ? 1 : ((p0 < t_rows) ? p0 : t_rows);
+            pos_x = (p1 == 0) ? 1 : ((p1 < t_cols) ? p1 : t_cols);
+            pos_valid = true; // absolute position
+            break;
+        default:
+            return; // no cursor movement (colors, erase, mode changes, requests)
+        }
+        pos_wrap = false;
+    }
+
+    void terminal_driver::track(const char *sequence, size_t seqlen)
+    {
+        if (!control_enabled || t_cols == 0 || t_rows == 0) {
+            pos_valid = false;
+            return;
+        }
+
+        //NOTE: keep parsing while position unknown so that escape sequence state stays in sync
+
+        const char *const seqend = sequence + seqlen;
+        for (; sequence < seqend; ++sequence) {
+            uint8_t c = (uint8_t)*sequence;
+            switch (out_state) {
+            case OUT_GROUND:
+                if (c == 0x1b) {
+                    out_state = OUT_ESC;
+                }
+                else if (c == '\r') {
+                    pos_x = 1;
+                    pos_wrap = false;
+                }
+                else if (c == '\n') {
+                    // ONLCR: newline also returns carriage
+                    pos_x = 1;
+                    pos_wrap = false;
+                    line_feed();
+                }
+                else if (c == '\b') {
+                    if (pos_x > 1)
+                        --pos_x;
+                    pos_wrap = false;
+                }
+                else if (c == '\t') {
+                    pos_x = ((pos_x - 1) / 8 + 1) * 8 + 1;
+                    if (pos_x > t_cols)
+                        pos_x = t_cols;
+                }
+                else if (c >= 0x20 && c != 0x7f && (c & 0xc0) != 0x80) {
+                    // printable (UTF-8 continuation bytes do not occupy a column)
+                    if (pos_wrap) {
+                        pos_x = 1;
+                        pos_wrap = false;
+                        line_feed();
+                    }
+                    if (pos_x < t_cols)
+                        ++pos_x;
+                    else
+                        pos_wrap = true;
+                }
+                break;
+            case OUT_ESC:
+                out_state = OUT_GROUND;
+                if (c == '[') {
+                    out_state = OUT_CSI;
+                    out_par[0] = out_par[1] = 0;
+                    out_npar = 0;
+                }
+                else if (c == ']' || c == 'P' || c == '_' || c == '^') {
+                    out_state = OUT_STR;
+                }
+                else if (c == '7') {
+                    save_x = pos_x; save_y = pos_y;
+                    save_valid = pos_valid; save_wrap = pos_wrap;
+                }
+                else if (c == '8') {
+                    pos_x = save_x; pos_y = save_y;
+                    pos_valid = save_valid; pos_wrap = save_wrap;
+                }
+                break;
+            case OUT_CSI:
+                if (isdigit(c)) {
+                    if (out_npar == 0)
+                        out_npar = 1;
+                    if (out_npar <= 2)
+                        out_par[out_npar-1] = out_par[out_npar-1] * 10 + (c - '0');
+                }
+                else if (c == ';') {
+                    if (out_npar == 0)
+                        out_npar = 1;
+                    ++out_npar;
+                }
+                else if (c >= 0x40 && c <= 0x7e) {
+                    if (out_npar > 2)
+                        out_npar = 2;
+                    track_csi((char)c);
+                    out_state = OUT_GROUND;
+                }
+                break;
+            case OUT_STR:
+                // string terminated by BEL or ST (ESC + '\\')
+                if (c == 0x07)
+                    out_state = OUT_GROUND;
+                else if (c == 0x1b)
+                    out_state = OUT_ESC;
+                break;
+            }
+        }
+    }
+
+    void terminal_driver::begin_frame()
+    {
+        ++frame_depth;
+    }
+
+    int terminal_driver::end_frame()
+    {
+        if (frame_depth > 0 && --frame_depth > 0)
+            return 0; // outer frame still open
+        return flush();
+    }
+
+    int terminal_driver::flush()
+    {
+        if (obuf.empty())
+            return 0;
+        int r = write__(obuf.data(), obuf.length());
+        obuf.clear();
+        return r;
+    }
+
     int terminal_driver::read(uint8_t &c, size_t timeout_s)
     {
         if (rbuf_enq <= rbuf_deq) {
@@ -32,6 +32,8 @@ SOFTWARE.
 
 #include <sys/time.h>
 
+#include <string>
+
 namespace libchars {
 
     class terminal_driver
@@ -47,7 +49,14 @@ namespace libchars {
         bool size_not_accurate;
         bool control_enabled;
         size_t t_cols; size_t t_rows;
+        // screen model: cursor position (1-based) tracked from all output
         size_t pos_x; size_t pos_y;
+        bool pos_valid; // position known; re-sync with terminal if not set
+        bool pos_wrap; // last column written; next printable character wraps
+        size_t save_x; size_t save_y;
+        bool save_valid; bool save_wrap;
+        enum { OUT_GROUND, OUT_ESC, OUT_CSI, OUT_STR } out_state;
+        size_t out_par[2]; size_t out_npar;
 
         uint8_t *rbuf;
         const static size_t RBUF_SIZE_LOG2_MAX = 20;
@@ -56,6 +65,10 @@ namespace libchars {
         size_t rbuf_enq;
         size_t rbuf_deq;
 
+        std::string obuf; // output gathered while a frame is open
+        size_t frame_depth;
+        size_t n_writes; // number of write system calls issued
+
     private:
         terminal_driver();
         ~terminal_driver();
@@ -81,6 +94,11 @@ namespace libchars {
         int reallocate(size_t size_log2);
         int read_characters(bool skip_force_check);
         void get_terminal_width_and_height();
+        int write__(const char *sequence, size_t seqlen);
+        int writev__(const char *sequence, size_t seqlen);
+        void track(const char *sequence, size_t seqlen);
+        void track_csi(char final);
+        void line_feed();
 
     public:
         inline bool control() const { return control_enabled; }
@@ -100,7 +118,10 @@ namespace libchars {
 
         inline bool interactive() const { return is_tty; }
 
-        int cursor_position(size_t &x, size_t &y, ssize_t timeout_ms = -1);
+        int cursor_position(size_t &x, size_t &y, ssize_t timeout_ms = -1); // query terminal (round-trip)
+
+        inline bool cursor_known() const { return pos_valid; }
+        inline void cursor_invalidate() { pos_valid = false; } // output bypassed driver; re-sync on next move
 
         void clear_screen();
         void clear_to_end_of_screen();
@@ -112,6 +133,12 @@ namespace libchars {
 
         int write(const char *sequence, size_t seqlen);
 
+        void begin_frame(); // gather output until matching end_frame(); frames may be nested
+        int end_frame();
+        int flush();
+
+        inline size_t write_syscalls() const { return n_writes; }
+
         int read(uint8_t &c, size_t timeout_s = 0);
 
         bool read_available() const;
@@ -125,6 +152,12 @@ namespace libchars {
             auto_cursor(terminal_driver &d) : driver(d) { driver.cursor_disable(); }
             ~auto_cursor() { driver.cursor_enable(); }
         };
+
+        struct auto_frame {
+            terminal_driver &driver;
+            auto_frame(terminal_driver &d) : driver(d) { driver.begin_frame(); }
+            ~auto_frame() { driver.end_frame(); }
+        };
     };
 
 }
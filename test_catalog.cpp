@@ -0,0 +1,177 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// stress check of a shared command catalog: reader threads parse without
+// locks while one writer adds, removes and (de)activates commands and sets,
+// and commits; a command found by a session must stay intact until the
+// session runs again, however many commits the writer makes in between
+//
+// usage: test_catalog [readers (4)] [commits (20000)]
+
+#include "commands.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace libchars;
+
+static const int N_STATIC = 500; // commands that are always there
+static const token::id_t ID_DYNAMIC = 100000; // commands added + removed by the writer
+
+struct shared_t
+{
+    terminal_driver *tdriver;
+    command_catalog *catalog;
+    int done;
+    int n_commits;
+};
+
+struct reader_t
+{
+    pthread_t thread;
+    shared_t *shared;
+    int t;
+    size_t parses;
+    size_t dynamic; // "dyn" found (set "B" active)
+    size_t bad;
+};
+
+static void *reader(void *arg)
+{
+    reader_t &R = *(reader_t *)arg;
+    commands session(*R.shared->tdriver, R.shared->catalog);
+    char line[128];
+    for (int k = 0; !__atomic_load_n(&R.shared->done, __ATOMIC_ACQUIRE); ++k) {
+        int i = (k * 7919 + R.t * 13) % N_STATIC;
+        snprintf(line, sizeof(line), "cmd%d sub%d count=%d %d", i, i % 7, k, R.t);
+        session.load(line);
+        if (session.run() != commands::VALID_COMMAND || session.get()->ID != (token::id_t)(i + 1)) {
+            ++R.bad;
+            continue;
+        }
+        token *K = session.find_key("count");
+        snprintf(line, sizeof(line), "%d", k);
+        if (K == NULL || K->next == NULL || K->next->value != line)
+            ++R.bad;
+
+        session.load("dyn");
+        if (session.run() == commands::VALID_COMMAND) {
+            // may be removed + committed by the writer right now; it must not
+            // be reclaimed before this session runs again
+            const command *cmd = session.get();
+            ++R.dynamic;
+            for (int y = 0; y < 4; ++y)
+                sched_yield();
+            if (cmd->ID < ID_DYNAMIC || cmd->ID >= ID_DYNAMIC + R.shared->n_commits || cmd->name != "dyn")
+                ++R.bad;
+        }
+        ++R.parses;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int n_readers = (argc > 1) ? atoi(argv[1]) : 4;
+    int n_commits = (argc > 2) ? atoi(argv[2]) : 20000;
+
+    // not a terminal: run() parses the line without editing it
+    int fd = open("/dev/null", O_RDWR);
+    assert(fd >= 0);
+    terminal_driver &tdriver = terminal_driver::initialize(fd, fd);
+
+    command_catalog catalog;
+    char name[64];
+    for (int i = 0; i < N_STATIC; ++i) {
+        snprintf(name, sizeof(name), "cmd%d sub%d", i, i % 7);
+        command *c = catalog.cset("A").add(name, i + 1); assert(c != NULL);
+        parameter *p = c->add(parameter(2,"count",validator::NONE)); assert(p != NULL);
+        p = c->add(parameter(3,validator::NONE)); assert(p != NULL);
+    }
+    catalog.cset("A").activate();
+    catalog.commit();
+
+    shared_t shared = { &tdriver, &catalog, 0, n_commits };
+    std::vector<reader_t> readers(n_readers);
+    for (int t = 0; t < n_readers; ++t) {
+        reader_t &R = readers[t];
+        R.shared = &shared;
+        R.t = t;
+        R.parses = R.dynamic = R.bad = 0;
+        int e = pthread_create(&R.thread, NULL, reader, &R);
+        assert(e == 0);
+    }
+
+    // writer: every commit replaces dictionaries + view; removed commands
+    // are retired, then reclaimed once no session can be using them
+    command *dyn = NULL, *extra = NULL;
+    for (int r = 0; r < n_commits; ++r) {
+        bool removed = true;
+        switch (r % 4) {
+        case 0:
+            dyn = catalog.cset("B").add("dyn", "dyn", ID_DYNAMIC + r);
+            assert(dyn != NULL);
+            break;
+        case 1:
+            catalog.cset("B").activate();
+            break;
+        case 2:
+            if (extra != NULL)
+                removed = catalog.cset("A").remove(extra);
+            snprintf(name, sizeof(name), "extra%d", r);
+            extra = catalog.cset("A").add(name, "extra", ID_DYNAMIC + r);
+            assert(extra != NULL);
+            break;
+        case 3:
+            removed = catalog.cset("B").remove(dyn);
+            if (r % 8 == 7)
+                catalog.cset("B").deactivate();
+            break;
+        }
+        assert(removed);
+        catalog.commit();
+        sched_yield(); // let readers see every state, even on one CPU
+    }
+
+    __atomic_store_n(&shared.done, 1, __ATOMIC_RELEASE);
+    size_t parses = 0, dynamic_found = 0, bad = 0;
+    for (int t = 0; t < n_readers; ++t) {
+        pthread_join(readers[t].thread, NULL);
+        parses += readers[t].parses;
+        dynamic_found += readers[t].dynamic;
+        bad += readers[t].bad;
+    }
+    catalog.commit();
+
+    printf("%d readers, %d commits: %zu parses (%zu of a changing command), %zu bad\n",
+           n_readers, n_commits, parses, dynamic_found, bad);
+    if (bad > 0 || parses == 0) {
+        fprintf(stderr, "FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,929 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// randomized checks of the frozen command dictionary; dictionaries are
+// compared through their snapshot images, byte for byte, and a corrupt
+// image must not be loaded; what cursors find (walks, help, abbreviations,
+// suggestions, TAB) is compared with a model of the commands
+
+#include "commands.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
+using namespace libchars;
+
+static const char *SNAPSHOT_A = "test_dictionary_a.snap";
+static const char *SNAPSHOT_B = "test_dictionary_b.snap";
+
+static std::string random_word()
+{
+    // short words over a small alphabet share prefixes; some have an escaped space
+    std::string w;
+    size_t n = 1 + rand() % 4;
+    for (size_t i = 0; i < n; ++i) {
+        if (rand() % 16 == 0)
+            w += "\\ ";
+        else
+            w += "abc~\xe9"[rand() % 5];
+    }
+    return w;
+}
+
+struct spec
+{
+    std::string cmd_str; // sanitized like command_set::add(): lexed words separated by one space
+    command::filter_t mask;
+    bool hidden;
+    command *cmd;
+};
+typedef std::vector<spec> specs_t;
+
+static void random_commands(size_t n, specs_t &specs)
+{
+    std::set<std::string> seen;
+    while (specs.size() < n) {
+        std::string raw;
+        size_t n_words = 1 + rand() % 3;
+        for (size_t w = 0; w < n_words; ++w) {
+            if (w > 0)
+                raw += ' ';
+            raw += random_word();
+        }
+        spec S;
+        std::unique_ptr<token> words(libchars::lexer(raw));
+        for (token *T = words.get(); T != NULL; T = T->next) {
+            if (T != words.get())
+                S.cmd_str += ' ';
+            S.cmd_str += T->value;
+        }
+        if (S.cmd_str.empty() || !seen.insert(S.cmd_str).second)
+            continue;
+        S.mask = (command::filter_t)1 << (rand() % 3);
+        S.hidden = (rand() % 4 == 0);
+        S.cmd = new command(S.cmd_str, NULL, S.mask, specs.size() + 1, S.hidden);
+        specs.push_back(S);
+    }
+}
+
+static void free_commands(specs_t &specs)
+{
+    for (size_t c = 0; c < specs.size(); ++c)
+        delete specs[c].cmd;
+    specs.clear();
+}
+
+static void build_tree(const specs_t &specs, command_node &tree)
+{
+    // the way build_commands() used to load a command set: one word at a time
+    for (size_t c = 0; c < specs.size(); ++c) {
+        const spec &S = specs[c];
+        std::unique_ptr<token> words(libchars::lexer(S.cmd_str));
+        command_node *cn = NULL;
+        for (token *T = words.get(); T != NULL; T = T->next) {
+            if (cn != NULL)
+                cn = cn->add_root(S.mask, S.hidden);
+            cn = (cn == NULL) ? tree.add(T->value, S.mask, S.hidden) : cn->add(T->value, S.mask, S.hidden);
+        }
+        cn->associate(S.cmd);
+    }
+}
+
+static bool same_image()
+{
+    // compare the two snapshot files byte for byte
+    FILE *fa = fopen(SNAPSHOT_A, "rb");
+    FILE *fb = fopen(SNAPSHOT_B, "rb");
+    bool same = (fa != NULL && fb != NULL);
+    while (same) {
+        int a = fgetc(fa), b = fgetc(fb);
+        if (a != b)
+            same = false;
+        else if (a == EOF)
+            break;
+    }
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+static bool check_bulk_build(size_t round)
+{
+    // build(commands) must produce exactly the dictionary of build(tree)
+    specs_t specs;
+    random_commands(rand() % 80, specs);
+
+    command_node tree;
+    build_tree(specs, tree);
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c)
+        commands.push_back(specs[c].cmd);
+
+    command_dictionary A, B;
+    A.build(tree);
+    B.build(commands);
+    bool ok = A.save(SNAPSHOT_A, 1) && B.save(SNAPSHOT_B, 1) && same_image();
+    if (!ok) {
+        fprintf(stderr, "round %zu: bulk build differs from build(tree) for:\n", round);
+        for (size_t c = 0; c < specs.size(); ++c)
+            fprintf(stderr, "  [%s] mask=%llx%s\n", specs[c].cmd_str.c_str(), (unsigned long long)specs[c].mask, specs[c].hidden ? " hidden" : "");
+    }
+    free_commands(specs);
+    return ok;
+}
+
+static bool read_file(const char *path, std::string &image)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+    char buffer[4096];
+    size_t n;
+    image.clear();
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        image.append(buffer, n);
+    fclose(f);
+    return true;
+}
+
+static bool write_file(const char *path, const std::string &image)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    bool ok = (fwrite(image.data(), image.size(), 1, f) == 1);
+    return (fclose(f) == 0) && ok;
+}
+
+static bool check_corrupt_image(size_t round)
+{
+    // load() of an image with one node reference out of range (or a child
+    // group that does not match its character map) must fail
+    specs_t specs;
+    random_commands(1 + rand() % 40, specs);
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c)
+        commands.push_back(specs[c].cmd);
+
+    typedef command_dictionary::node node;
+    command_dictionary D;
+    D.build(commands);
+    std::string image;
+    bool ok = D.save(SNAPSHOT_A, 1) && read_file(SNAPSHOT_A, image);
+
+    // the node array is found in the image by the bytes of the root node
+    size_t at = 0;
+    while (ok && (at + sizeof(node)) <= image.size() && memcmp(image.data() + at, &D.at(0), sizeof(node)) != 0)
+        at += 8;
+    ok = ok && (at + D.size() * sizeof(node)) <= image.size();
+
+    // (the root of the first word always has children)
+    command_dictionary::index_t k = rand() % D.size();
+    int corruption = rand() % 8;
+    if (corruption >= 6) {
+        k = rand() % D.size();
+        while (D.at(k).n_children == 0)
+            k = (k + 1) % D.size();
+        if (corruption == 7)
+            k = D.at(k).child + rand() % D.at(k).n_children;
+    }
+    node N = D.at(k);
+    switch (corruption) {
+    case 0: N.label_length = 0xffffff00; break;
+    case 1: N.child = D.size(); N.n_children = 1; break;
+    case 2: N.n_children = N.n_children + D.size(); break;
+    case 3: N.map = 0x7fffffff; break;
+    case 4: N.start = D.size(); break;
+    case 5: N.cmd = D.n_commands(); break;
+    case 6: N.n_children = N.n_children - 1; break; // more children in map than in group
+    case 7: N.label_length = 0; break; // child that consumes no input
+    }
+    if (ok) {
+        memcpy(&image[at + k * sizeof(node)], &N, sizeof(node));
+        ok = write_file(SNAPSHOT_B, image);
+    }
+
+    command_dictionary A, B;
+    ok = ok && A.load(SNAPSHOT_A, 1) && !B.load(SNAPSHOT_B, 1);
+    if (!ok)
+        fprintf(stderr, "round %zu: corrupt node %u (corruption %d) not rejected\n", round, (unsigned)k, corruption);
+    free_commands(specs);
+    return ok;
+}
+
+static bool check_long_words()
+{
+    // words far longer than MAX_WORD, on paths of more than MAX_WORD nodes
+    // (a branch at every character): the cursor continues on the heap
+    const size_t L = 3 * command_dictionary::MAX_WORD;
+    std::string base(L, 'a'), stem = "c" + std::string(2 * command_dictionary::MAX_WORD, 'a');
+    std::set<std::string> words;
+    for (size_t i = 0; i < L; ++i)
+        words.insert(base.substr(0, i) + "b");
+    words.insert(base);
+    words.insert(stem + "x");
+    words.insert(stem + "y");
+
+    std::vector<command*> commands;
+    for (std::set<std::string>::const_iterator w = words.begin(); w != words.end(); ++w)
+        commands.push_back(new command(*w, NULL, 1, commands.size() + 1));
+    command_dictionary D;
+    D.build(commands);
+    std::vector<const command_dictionary*> overlay(1, &D);
+
+    // every word found, with its own command, and spelled in full
+    bool ok = true;
+    word_buffer wb;
+    std::set<std::string>::const_iterator it = words.begin();
+    for (size_t c = 0; ok && c < commands.size(); ++c, ++it) {
+        command_cursor at(overlay);
+        ok = at.find(*it, 1) && at.end() && at.get(1) == commands[c] &&
+             at.word(wb) == it->length() && memcmp(wb.str(), it->data(), it->length()) == 0;
+    }
+
+    // all words listed, in order (next() also stops where words branch)
+    command_cursor all(overlay);
+    it = words.begin();
+    while (ok && all.next(1)) {
+        if (!all.command(1))
+            continue;
+        all.word(wb);
+        ok = (it != words.end() && *it == std::string(wb.str(), wb.length()));
+        ++it;
+    }
+    ok = ok && it == words.end();
+
+    // common part of two words beyond MAX_WORD characters
+    command_cursor at(overlay), common;
+    bool exact;
+    ok = ok && at.find("c", 1) && at.complete(1, common, exact) == 2 &&
+         common.word(wb) == stem.length() && memcmp(wb.str(), stem.data(), stem.length()) == 0;
+
+    if (!ok)
+        fprintf(stderr, "long words: not found, listed or completed in full\n");
+    for (size_t c = 0; c < commands.size(); ++c)
+        delete commands[c];
+    return ok;
+}
+
+static void plain_commands(size_t n, const char *alphabet, specs_t &specs)
+{
+    // 1-3 words of 1-4 characters; no escapes, so a word is what is between spaces
+    std::set<std::string> seen;
+    size_t n_alphabet = strlen(alphabet);
+    while (specs.size() < n) {
+        spec S;
+        size_t n_words = 1 + rand() % 3;
+        for (size_t w = 0; w < n_words; ++w) {
+            if (w > 0)
+                S.cmd_str += ' ';
+            size_t length = 1 + rand() % 4;
+            for (size_t i = 0; i < length; ++i)
+                S.cmd_str += alphabet[rand() % n_alphabet];
+        }
+        if (!seen.insert(S.cmd_str).second)
+            continue;
+        S.mask = (command::filter_t)1 << (rand() % 3);
+        S.hidden = (rand() % 4 == 0);
+        S.cmd = new command(S.cmd_str, NULL, S.mask, specs.size() + 1, S.hidden);
+        specs.push_back(S);
+    }
+}
+
+typedef std::vector<std::string> lines_t; // "<words> #<ID of command ending here; 0 if none>[ +]" (+: more words follow)
+
+static void walk(const std::vector<const command_dictionary*> &overlay, const std::vector<std::string> &before,
+                 command::filter_t mask, bool ignore_hidden, lines_t &lines)
+{
+    // every word the cursors offer after the words 'before', depth first
+    command_cursor c(overlay);
+    std::string prefix;
+    for (size_t k = 0; k < before.size(); ++k) {
+        if (!c.find(before[k], mask, ignore_hidden) || !c.next_root())
+            return;
+        prefix += before[k] + " ";
+    }
+    word_buffer wb;
+    command_cursor e(c);
+    while (e.next(mask, ignore_hidden)) {
+        bool ends = e.command(mask, ignore_hidden), more = e.subword(mask, ignore_hidden);
+        if (!ends && !more)
+            continue;
+        e.word(wb);
+        char flags[32];
+        snprintf(flags, sizeof(flags), " #%d%s", ends ? (int)e.get(mask, ignore_hidden)->ID : 0, more ? " +" : "");
+        lines.push_back(prefix + std::string(wb.str(), wb.length()) + flags);
+        if (more) {
+            std::vector<std::string> next(before);
+            next.push_back(std::string(wb.str(), wb.length()));
+            walk(overlay, next, mask, ignore_hidden, lines);
+        }
+    }
+}
+
+static void walk(const command_dictionary &D, command::filter_t mask, bool ignore_hidden, lines_t &lines)
+{
+    walk(std::vector<const command_dictionary*>(1, &D), std::vector<std::string>(), mask, ignore_hidden, lines);
+    std::sort(lines.begin(), lines.end());
+}
+
+static void expected(const specs_t &specs, const std::vector<bool> &in, command::filter_t mask, bool ignore_hidden, lines_t &lines)
+{
+    // what walk() must find: every word sequence that starts a visible command
+    std::map<std::string,std::pair<int,bool> > paths;
+    for (size_t c = 0; c < specs.size(); ++c) {
+        const spec &S = specs[c];
+        if (!in[c] || (S.mask & mask) == 0 || (S.hidden && !ignore_hidden))
+            continue;
+        for (size_t e = S.cmd_str.find(' '); ; e = S.cmd_str.find(' ', e + 1)) {
+            std::pair<int,bool> &P = paths.insert(std::make_pair(S.cmd_str.substr(0, e), std::make_pair(0, false))).first->second;
+            if (e == std::string::npos) {
+                P.first = S.cmd->ID;
+                break;
+            }
+            P.second = true;
+        }
+    }
+    for (std::map<std::string,std::pair<int,bool> >::const_iterator P = paths.begin(); P != paths.end(); ++P) {
+        char flags[32];
+        snprintf(flags, sizeof(flags), " #%d%s", P->second.first, P->second.second ? " +" : "");
+        lines.push_back(P->first + flags);
+    }
+    std::sort(lines.begin(), lines.end());
+}
+
+static bool same_walk(const command_dictionary &D, const specs_t &specs, const std::vector<bool> &in, const char *what, size_t round)
+{
+    // for every filter bit, with and without hidden commands
+    for (command::filter_t mask = 1; mask < 8; mask <<= 1) {
+        for (int ignore_hidden = 0; ignore_hidden < 2; ++ignore_hidden) {
+            lines_t found, model;
+            walk(D, mask, ignore_hidden, found);
+            expected(specs, in, mask, ignore_hidden, model);
+            if (found != model) {
+                fprintf(stderr, "round %zu: %s; mask=%llx%s:\n", round, what, (unsigned long long)mask, ignore_hidden ? " (+hidden)" : "");
+                for (size_t k = 0; k < std::max(found.size(), model.size()); ++k)
+                    fprintf(stderr, "  %-24s %s\n", k < found.size() ? found[k].c_str() : "", k < model.size() ? model[k].c_str() : "");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool check_in_place(size_t round)
+{
+    // insert() + remove() only touch the path of the command; the result
+    // must answer every query like a build of the same commands
+    specs_t specs;
+    plain_commands(10 + rand() % 60, "abc", specs);
+    std::vector<bool> in(specs.size(), false);
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c) {
+        in[c] = (rand() % 2 == 0);
+        if (in[c])
+            commands.push_back(specs[c].cmd);
+    }
+    command_dictionary D;
+    D.build(commands);
+
+    bool ok = true;
+    for (size_t k = 0; ok && k < 60; ++k) {
+        size_t c = rand() % specs.size();
+        if (in[c])
+            ok = D.remove(specs[c].cmd);
+        else
+            D.insert(specs[c].cmd);
+        in[c] = !in[c];
+        c = rand() % specs.size();
+        if (!in[c] && D.remove(specs[c].cmd))
+            ok = false; // not there
+    }
+    if (!ok)
+        fprintf(stderr, "round %zu: remove() found a command not inserted, or missed one\n", round);
+
+    commands.clear();
+    for (size_t c = 0; c < specs.size(); ++c)
+        if (in[c])
+            commands.push_back(specs[c].cmd);
+    command_dictionary F;
+    F.build(commands);
+    ok = ok && same_walk(D, specs, in, "updated in place", round) && same_walk(F, specs, in, "built", round);
+    free_commands(specs);
+    return ok;
+}
+
+static void split(const std::string &cmd_str, std::vector<std::string> &words)
+{
+    words.clear();
+    for (size_t from = 0; ; ) {
+        size_t e = cmd_str.find(' ', from);
+        words.push_back(cmd_str.substr(from, e == std::string::npos ? e : e - from));
+        if (e == std::string::npos)
+            break;
+        from = e + 1;
+    }
+}
+
+static void random_prefix(const specs_t &specs, const char *alphabet, std::vector<std::string> &words, std::string &partial)
+{
+    // whole words + the start of the next word of some command, or a random start
+    split(specs[rand() % specs.size()].cmd_str, words);
+    size_t k = rand() % words.size();
+    partial = words[k].substr(0, 1 + rand() % words[k].length());
+    words.resize(k);
+    if (rand() % 4 == 0)
+        partial = alphabet[rand() % strlen(alphabet)];
+}
+
+static bool position(command_cursor &c, const std::vector<std::string> &words, const std::string &partial,
+                     command::filter_t mask, bool ignore_hidden)
+{
+    for (size_t k = 0; k < words.size(); ++k)
+        if (!c.find(words[k], mask, ignore_hidden) || !c.next_root())
+            return false;
+    return c.find(partial, mask, ignore_hidden);
+}
+
+static bool extends(const spec &S, const std::vector<std::string> &words, const std::string &partial)
+{
+    // command starts with 'words' and its next word starts with 'partial'
+    std::vector<std::string> cw;
+    split(S.cmd_str, cw);
+    if (cw.size() <= words.size())
+        return false;
+    for (size_t k = 0; k < words.size(); ++k)
+        if (cw[k] != words[k])
+            return false;
+    return cw[words.size()].compare(0, partial.length(), partial) == 0;
+}
+
+static bool check_filters(size_t round)
+{
+    // enumeration and help only go into subtrees with commands that pass
+    // the filter; what they find must be what passes it, nothing less
+    specs_t specs;
+    plain_commands(1 + rand() % 80, "abc", specs);
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c)
+        commands.push_back(specs[c].cmd);
+    command_dictionary D;
+    D.build(commands);
+    std::vector<const command_dictionary*> overlay(1, &D);
+
+    bool ok = same_walk(D, specs, std::vector<bool>(specs.size(), true), "filtered walk", round);
+    for (size_t q = 0; ok && q < 40; ++q) {
+        std::vector<std::string> words;
+        std::string partial;
+        random_prefix(specs, "abc", words, partial);
+        command::filter_t mask = (command::filter_t)1 << (rand() % 3);
+        bool ignore_hidden = (rand() % 2 == 0);
+
+        std::set<command*> model, found;
+        for (size_t c = 0; c < specs.size(); ++c)
+            if ((specs[c].mask & mask) != 0 && (ignore_hidden || !specs[c].hidden) && extends(specs[c], words, partial))
+                model.insert(specs[c].cmd);
+        command_cursor c(overlay);
+        if (position(c, words, partial, mask, ignore_hidden)) {
+            std::vector<command*> match;
+            c.collect(mask, ignore_hidden, match);
+            found.insert(match.begin(), match.end());
+            ok = (match.size() == found.size()); // each command once
+        }
+        if (!ok || found != model) {
+            fprintf(stderr, "round %zu: help for [%s] (%zu words before) mask=%llx: %zu commands, expected %zu\n",
+                    round, partial.c_str(), words.size(), (unsigned long long)mask, found.size(), model.size());
+            ok = false;
+        }
+    }
+    free_commands(specs);
+    return ok;
+}
+
+static command *resolve(const specs_t &specs, const std::vector<std::string> &tokens, command::filter_t mask, std::string &spelled)
+{
+    // model of abbreviations: a token that is a word is taken as is,
+    // otherwise it must be the start of exactly one word that can follow
+    std::vector<std::string> resolved;
+    spelled.clear();
+    for (size_t k = 0; k < tokens.size(); ++k) {
+        std::set<std::string> candidates;
+        for (size_t c = 0; c < specs.size(); ++c) {
+            std::vector<std::string> cw;
+            split(specs[c].cmd_str, cw);
+            if ((specs[c].mask & mask) == 0 || cw.size() <= k ||
+                !std::equal(resolved.begin(), resolved.end(), cw.begin()) ||
+                cw[k].compare(0, tokens[k].length(), tokens[k]) != 0)
+                continue;
+            candidates.insert(cw[k]);
+        }
+        if (candidates.count(tokens[k]) == 0 && candidates.size() != 1)
+            return NULL;
+        resolved.push_back(candidates.count(tokens[k]) ? tokens[k] : *candidates.begin());
+        spelled += resolved.back() + " ";
+    }
+    for (size_t c = 0; c < specs.size(); ++c) {
+        std::vector<std::string> cw;
+        split(specs[c].cmd_str, cw);
+        if ((specs[c].mask & mask) != 0 && cw == resolved)
+            return specs[c].cmd;
+    }
+    return NULL;
+}
+
+static bool check_abbreviations(size_t round)
+{
+    // the way a line is parsed with abbreviations enabled: find() + expand()
+    // per token (hidden commands can be run, but are not offered)
+    specs_t specs;
+    plain_commands(1 + rand() % 60, "abc", specs);
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c)
+        commands.push_back(specs[c].cmd);
+    command_dictionary D;
+    D.build(commands);
+    std::vector<const command_dictionary*> overlay(1, &D);
+
+    bool ok = true;
+    word_buffer wb;
+    for (size_t q = 0; ok && q < 60; ++q) {
+        // some command, its words cut short (or a random start)
+        std::vector<std::string> tokens;
+        split(specs[rand() % specs.size()].cmd_str, tokens);
+        tokens.resize(1 + rand() % tokens.size());
+        for (size_t k = 0; k < tokens.size(); ++k)
+            tokens[k] = (rand() % 8 == 0) ? std::string(1, "abc"[rand() % 3]) : tokens[k].substr(0, 1 + rand() % tokens[k].length());
+        command::filter_t mask = (command::filter_t)1 << (rand() % 3);
+
+        std::string spelled, model_spelled;
+        command *model = resolve(specs, tokens, mask, model_spelled);
+        command_cursor c(overlay);
+        bool found = true;
+        for (size_t k = 0; found && k < tokens.size(); ++k) {
+            found = c.find(tokens[k], mask, true) && c.expand(mask, true);
+            if (found) {
+                c.word(wb);
+                spelled += std::string(wb.str(), wb.length()) + " ";
+            }
+            if (found && (k + 1) < tokens.size())
+                found = c.next_root();
+        }
+        command *cmd = (found && c.end() && c.command(mask, true)) ? c.get(mask, true) : NULL;
+        if (cmd != model || (model != NULL && spelled != model_spelled)) {
+            std::string line;
+            for (size_t k = 0; k < tokens.size(); ++k)
+                line += tokens[k] + " ";
+            fprintf(stderr, "round %zu: [%s] mask=%llx resolved to [%s] #%d, expected [%s] #%d\n", round, line.c_str(),
+                    (unsigned long long)mask, spelled.c_str(), cmd ? cmd->ID : 0, model_spelled.c_str(), model ? model->ID : 0);
+            ok = false;
+        }
+    }
+    free_commands(specs);
+    return ok;
+}
+
+static size_t distance(const std::string &a, const std::string &b)
+{
+    // optimal string alignment: insert, delete, substitute, transpose adjacent
+    std::vector<std::vector<size_t> > d(a.length() + 1, std::vector<size_t>(b.length() + 1));
+    for (size_t i = 0; i <= a.length(); ++i)
+        d[i][0] = i;
+    for (size_t j = 0; j <= b.length(); ++j)
+        d[0][j] = j;
+    for (size_t i = 1; i <= a.length(); ++i) {
+        for (size_t j = 1; j <= b.length(); ++j) {
+            d[i][j] = std::min(std::min(d[i - 1][j] + 1, d[i][j - 1] + 1), d[i - 1][j - 1] + (a[i - 1] != b[j - 1] ? 1 : 0));
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+                d[i][j] = std::min(d[i][j], d[i - 2][j - 2] + 1);
+        }
+    }
+    return d[a.length()][b.length()];
+}
+
+static bool same_suggestions(const command_dictionary &D, const specs_t &specs, const std::vector<bool> &in, size_t round)
+{
+    std::set<std::string> words;
+    for (size_t c = 0; c < specs.size(); ++c) {
+        std::vector<std::string> cw;
+        split(specs[c].cmd_str, cw);
+        if (in[c])
+            words.insert(cw.begin(), cw.end());
+    }
+
+    bool ok = true;
+    for (size_t q = 0; ok && q < 10; ++q) {
+        std::string search;
+        for (size_t n = 1 + rand() % 5; n > 0; --n)
+            search += "abcd"[rand() % 4];
+        command_dictionary::suggestions_t found, model;
+        D.suggest(search, found);
+        std::sort(found.begin(), found.end());
+        for (std::set<std::string>::const_iterator w = words.begin(); w != words.end(); ++w) {
+            size_t d = distance(search, *w);
+            if (d <= 2)
+                model.push_back(std::make_pair(d, *w));
+        }
+        std::sort(model.begin(), model.end());
+        if (found != model) {
+            fprintf(stderr, "round %zu: suggestions for [%s]: %zu, expected %zu\n", round, search.c_str(), found.size(), model.size());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool check_suggestions(size_t round)
+{
+    // "did you mean": every word of any command within distance 2, each once;
+    // the index is built on first suggest() and must not outlive any change,
+    // also one that adds no node (a word ending on an existing node)
+    specs_t specs;
+    plain_commands(1 + rand() % 60, "abcd", specs);
+    std::set<std::string> seen;
+    for (size_t c = 0; c < specs.size(); ++c)
+        seen.insert(specs[c].cmd_str);
+    for (size_t c = 0, n = specs.size(); c < n; ++c) {
+        // one-word commands that are prefixes of words already there
+        std::vector<std::string> cw;
+        split(specs[c].cmd_str, cw);
+        spec S;
+        S.cmd_str = cw[0].substr(0, 1 + rand() % cw[0].length());
+        if (!seen.insert(S.cmd_str).second)
+            continue;
+        S.mask = 1;
+        S.hidden = false;
+        S.cmd = new command(S.cmd_str, NULL, S.mask, specs.size() + 1, S.hidden);
+        specs.push_back(S);
+    }
+
+    std::vector<bool> in(specs.size(), false);
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c) {
+        in[c] = (rand() % 2 == 0);
+        if (in[c])
+            commands.push_back(specs[c].cmd);
+    }
+    command_dictionary D;
+    if (round % 2 == 0) {
+        D.build(commands);
+    }
+    else {
+        D.build(std::vector<command*>());
+        command_dictionary::suggestions_t none;
+        D.suggest("a", none);
+        for (size_t c = 0; c < commands.size(); ++c)
+            D.insert(commands[c]);
+    }
+
+    bool ok = same_suggestions(D, specs, in, round);
+    for (size_t k = 0; ok && k < 5; ++k) {
+        size_t c = rand() % specs.size();
+        if (in[c])
+            ok = D.remove(specs[c].cmd);
+        else
+            D.insert(specs[c].cmd);
+        in[c] = !in[c];
+        ok = ok && same_suggestions(D, specs, in, round);
+    }
+    free_commands(specs);
+    return ok;
+}
+
+static std::string folded(std::string s)
+{
+    for (size_t i = 0; i < s.length(); ++i)
+        s[i] = tolower((unsigned char)s[i]);
+    return s;
+}
+
+static std::string mixed_case(std::string s)
+{
+    for (size_t i = 0; i < s.length(); ++i)
+        if (rand() % 2 == 0)
+            s[i] = toupper((unsigned char)s[i]);
+    return s;
+}
+
+static bool spelled_by_owner(const specs_t &specs, const std::vector<std::string> &words, size_t k, const std::string &spelled)
+{
+    // every character of word 'k' as shown is spelled that way by a command
+    // through the node it is on (same words before, same folded prefix)
+    for (size_t p = 0; p < spelled.length(); ++p) {
+        bool owned = false;
+        for (size_t c = 0; !owned && c < specs.size(); ++c) {
+            std::vector<std::string> cw;
+            split(specs[c].cmd_str, cw);
+            if (cw.size() <= k || cw[k].length() <= p || cw[k][p] != spelled[p] ||
+                folded(cw[k].substr(0, p + 1)) != folded(words[k].substr(0, p + 1)))
+                continue;
+            owned = true;
+            for (size_t w = 0; owned && w < k; ++w)
+                owned = folded(cw[w]) == folded(words[w]);
+        }
+        if (!owned)
+            return false;
+    }
+    return true;
+}
+
+static bool check_ignore_case(size_t round)
+{
+    // commands added in mixed case; any spelling of a word finds it, the
+    // word is shown as spelled by a command through it (not by one that only
+    // shares the folded label elsewhere), and the dictionary answers like a
+    // case-sensitive one of the folded commands
+    specs_t specs, model;
+    plain_commands(1 + rand() % 60, "abc", specs);
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c) {
+        spec &S = specs[c];
+        model.push_back(S);
+        S.cmd_str = mixed_case(S.cmd_str);
+        delete S.cmd;
+        S.cmd = model[c].cmd = new command(S.cmd_str, NULL, S.mask, c + 1, S.hidden);
+        commands.push_back(S.cmd);
+    }
+    command_dictionary D;
+    if (round % 2 == 0) {
+        D.build(commands, true);
+    }
+    else {
+        D.build(std::vector<command*>(), true);
+        for (size_t c = 0; c < commands.size(); ++c)
+            D.insert(commands[c]);
+    }
+    std::vector<const command_dictionary*> overlay(1, &D);
+
+    bool ok = true;
+    word_buffer wb;
+    for (size_t c = 0; ok && c < specs.size(); ++c) {
+        std::vector<std::string> words;
+        split(specs[c].cmd_str, words);
+        command_cursor at(overlay);
+        bool misspelled = false;
+        for (size_t k = 0; ok && k < words.size(); ++k) {
+            std::string search = mixed_case(folded(words[k]));
+            ok = at.find(search, command::UNLOCK_ALL, true) && at.end() && at.word(wb) == search.length() &&
+                 folded(std::string(wb.str(), wb.length())) == folded(search) &&
+                 ((k + 1) == words.size() || at.next_root());
+            if (ok && !spelled_by_owner(specs, words, k, std::string(wb.str(), wb.length()))) {
+                fprintf(stderr, "round %zu: word %zu of [%s] shown as [%.*s]\n", round, k, specs[c].cmd_str.c_str(), (int)wb.length(), wb.str());
+                misspelled = true;
+                ok = false;
+            }
+        }
+        ok = ok && at.get(command::UNLOCK_ALL, true) == specs[c].cmd;
+        if (!ok && !misspelled)
+            fprintf(stderr, "round %zu: [%s] not found in any case\n", round, specs[c].cmd_str.c_str());
+    }
+
+    // every word listed once (in one of its spellings)
+    for (command::filter_t mask = 1; ok && mask < 8; mask <<= 1) {
+        lines_t found, expect;
+        walk(D, mask, true, found);
+        for (size_t k = 0; k < found.size(); ++k)
+            found[k] = folded(found[k]);
+        std::sort(found.begin(), found.end());
+        expected(model, std::vector<bool>(model.size(), true), mask, true, expect);
+        if (found != expect) {
+            fprintf(stderr, "round %zu: case-insensitive walk differs; mask=%llx\n", round, (unsigned long long)mask);
+            ok = false;
+        }
+    }
+    free_commands(specs);
+    return ok;
+}
+
+static bool check_completion(size_t round)
+{
+    // TAB: number of words that extend the current one (counted from the
+    // node summaries), and their common part
+    specs_t specs;
+    plain_commands(1 + rand() % 80, "abc", specs);
+    if (rand() % 2 == 0) {
+        // one filter bit for all: summaries answer for whole subtrees
+        for (size_t c = 0; c < specs.size(); ++c) {
+            specs[c].mask = 1;
+            delete specs[c].cmd;
+            specs[c].cmd = new command(specs[c].cmd_str, NULL, 1, c + 1, specs[c].hidden);
+        }
+    }
+    std::vector<command*> commands;
+    for (size_t c = 0; c < specs.size(); ++c)
+        commands.push_back(specs[c].cmd);
+    command_dictionary D;
+    if (round % 2 == 0) {
+        D.build(commands);
+    }
+    else {
+        D.build(std::vector<command*>());
+        for (size_t c = 0; c < commands.size(); ++c)
+            D.insert(commands[c]);
+    }
+    std::vector<const command_dictionary*> overlay(1, &D);
+
+    bool ok = true;
+    word_buffer wb;
+    for (size_t q = 0; ok && q < 40; ++q) {
+        std::vector<std::string> words;
+        std::string partial;
+        random_prefix(specs, "abc", words, partial);
+        command::filter_t mask = (command::filter_t)1 << (rand() % 3);
+
+        // model: visible words in this position that start with 'partial'
+        std::set<std::string> W;
+        for (size_t c = 0; c < specs.size(); ++c) {
+            std::vector<std::string> cw;
+            split(specs[c].cmd_str, cw);
+            if ((specs[c].mask & mask) != 0 && !specs[c].hidden && extends(specs[c], words, partial))
+                W.insert(cw[words.size()]);
+        }
+        W.erase(partial);
+        std::string common_part = partial;
+        if (!W.empty()) {
+            const std::string &a = *W.begin(), &b = *W.rbegin();
+            size_t p = 0;
+            while (p < a.length() && p < b.length() && a[p] == b[p])
+                ++p;
+            common_part = a.substr(0, p);
+        }
+
+        command_cursor c(overlay), common;
+        bool exact = true;
+        size_t n = position(c, words, partial, mask, false) ? c.complete(mask, common, exact) : 0;
+        if (n > 0)
+            common.word(wb);
+        if (n != W.size() || (n > 0 && std::string(wb.str(), wb.length()) != common_part)) {
+            fprintf(stderr, "round %zu: TAB on [%s] (%zu words before) mask=%llx: %zu words [%s], expected %zu [%s]\n",
+                    round, partial.c_str(), words.size(), (unsigned long long)mask, n, n > 0 ? wb.str() : "",
+                    W.size(), common_part.c_str());
+            ok = false;
+        }
+    }
+    free_commands(specs);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int seed = (argc > 1) ? strtoul(argv[1],NULL,0) : 1;
+    srand(seed);
+
+    bool ok = true;
+    for (size_t round = 0; ok && round < 1000; ++round)
+        ok = check_bulk_build(round);
+    for (size_t round = 0; ok && round < 200; ++round)
+        ok = check_corrupt_image(round);
+    for (size_t round = 0; ok && round < 300; ++round)
+        ok = check_in_place(round);
+    for (size_t round = 0; ok && round < 300; ++round)
+        ok = check_filters(round);
+    for (size_t round = 0; ok && round < 300; ++round)
+        ok = check_abbreviations(round);
+    for (size_t round = 0; ok && round < 200; ++round)
+        ok = check_suggestions(round);
+    for (size_t round = 0; ok && round < 300; ++round)
+        ok = check_ignore_case(round);
+    for (size_t round = 0; ok && round < 300; ++round)
+        ok = check_completion(round);
+    ok = ok && check_long_words();
+
+    unlink(SNAPSHOT_A);
+    unlink(SNAPSHOT_B);
+
+    if (!ok) {
+        fprintf(stderr, "FAILED (seed %u)\n", seed);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -42,19 +42,20 @@ struct cmd_obj : public libchars::edit_object
         if ((buf_idx + limit) > length())
             limit = length() - buf_idx;
 
+        sequence.clear();
         if (buf_idx >= 10) {
-            sequence.assign(value(), buf_idx, limit);
+            copy(buf_idx, limit, sequence);
         }
         else {
             sequence.assign(COLOR_KEYWORD);
             if ((buf_idx + limit) <= 10) {
-                sequence.append(value(), buf_idx, limit);
+                copy(buf_idx, limit, sequence);
                 sequence.append(COLOR_NORMAL);
             }
             else {
-                sequence.append(value(), buf_idx, 10 - buf_idx);
+                copy(buf_idx, 10 - buf_idx, sequence);
                 sequence.append(COLOR_NORMAL);
-                sequence.append(value(), 10, limit - (10 - buf_idx));
+                copy(10, limit - (10 - buf_idx), sequence);
             }
         }
 
@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// sample of a compiled-in command snapshot: the commands of a session are
+// loaded from the image that gen_commands generated at build time (nothing
+// is built at startup); checked against a session that adds the same
+// definitions at run time, line by line and for every filter
+
+#include "sample_commands.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static std::string result(commands &session, const char *line, command::filter_t mask)
+{
+    // status, command, arguments: enough to tell two parses apart
+    char buffer[64];
+    session.load(line);
+    snprintf(buffer, sizeof(buffer), "%d", (int)session.run(mask));
+    std::string r(buffer);
+    if (session.get() != NULL) {
+        snprintf(buffer, sizeof(buffer), ":%d", (int)session.get()->ID);
+        r += buffer;
+    }
+    for (const token *T = session.args(); T != NULL; T = T->next) {
+        snprintf(buffer, sizeof(buffer), "|%d/%u=", (int)T->ID, (unsigned)T->status);
+        r += buffer;
+        r += T->value;
+    }
+    return r;
+}
+
+int main(void)
+{
+    // not a terminal: run() parses the line without editing it
+    int fd = open("/dev/null", O_RDWR);
+    assert(fd >= 0);
+    terminal_driver &tdriver = terminal_driver::initialize(fd, fd);
+
+    commands built(tdriver), compiled(tdriver);
+    bool ok = built.cset().add(__sample_commands, sizeof(__sample_commands) / sizeof(__sample_commands[0]));
+    assert(ok);
+
+    // used in place; a hash of other definitions is refused
+    ok = compiled.cset().load(sample_commands_image, sample_commands_image_size, SAMPLE_COMMANDS_HASH + 1);
+    assert(!ok);
+    ok = compiled.cset().load(sample_commands_image, sample_commands_image_size, SAMPLE_COMMANDS_HASH);
+    assert(ok);
+
+    static const char *lines[] = {
+        "show interface eth0", "show interface verbose count=3 eth1", "sh int", "show version",
+        "set interface eth0 mtu=1500", "set interface eth0", "set interface eth0 mtu=9000 secret=y",
+        "debug dump", "exit", "show version x", "s", "show interface eth0 extra", "",
+    };
+    size_t bad = 0;
+    for (command::filter_t mask = 1; mask < 4; ++mask) {
+        for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); ++i) {
+            std::string a = result(built, lines[i], mask), b = result(compiled, lines[i], mask);
+            if (a != b) {
+                fprintf(stderr, "[%s] mask=%u: built %s, compiled %s\n", lines[i], (unsigned)mask, a.c_str(), b.c_str());
+                ++bad;
+            }
+        }
+    }
+
+    if (bad > 0) {
+        fprintf(stderr, "FAILED\n");
+        return 1;
+    }
+    printf("OK (%zu byte image)\n", sample_commands_image_size);
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// randomized check of the incremental lexer: after random edits, the kept
+// token list must equal a full lex of the line, and the parse result of the
+// session must equal that of a fresh session given the same line; values
+// are only validated again when the edit touched their token
+
+#include "commands.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace libchars;
+
+static const size_t N_SUM = 40; // positional arguments of "sum"
+
+struct digits_validator : public validator
+{
+    mutable size_t checks;
+
+    digits_validator() : checks(0) {}
+
+    virtual status_t check(const std::string &value) const
+    {
+        ++checks;
+        if (value.empty())
+            return PARTIAL;
+        for (size_t i = 0; i < value.length(); ++i)
+            if (value[i] < '0' || value[i] > '9')
+                return INVALID;
+        return VALID;
+    }
+};
+
+static void load_commands(command_catalog &catalog, validator::id_t digits)
+{
+    command *c = NULL;
+    parameter *p = NULL;
+
+    command_set &C_set = catalog.cset();
+
+    c = C_set.add("throw ball",1); assert(c != NULL);
+    p = c->add(parameter(1,"angle",digits)); assert(p != NULL);
+    p->set_default("45");
+    p = c->add(parameter(2,"hard")); assert(p != NULL);
+    p = c->add(parameter(3,validator::NONE)); assert(p != NULL);
+    p = c->add(parameter(4,validator::NONE)); assert(p != NULL);
+    p->set_optional();
+
+    c = C_set.add("throw ball back",2); assert(c != NULL);
+    c = C_set.add("throw away",3); assert(c != NULL);
+    c = C_set.add("set ball",4); assert(c != NULL);
+    p = c->add(parameter(1,"color",validator::NONE)); assert(p != NULL);
+    p = c->add(parameter(2,"fast")); assert(p != NULL);
+    p = c->add(parameter(3,validator::NONE)); assert(p != NULL);
+    p->set_default("ACME");
+    c = C_set.add("sum",5); assert(c != NULL);
+    for (size_t i = 0; i < N_SUM; ++i) {
+        p = c->add(parameter(i + 1,digits)); assert(p != NULL);
+        p->set_optional();
+    }
+
+    catalog.commit();
+}
+
+static bool same_parse(commands &A, commands &B)
+{
+    if (A.run() != B.run() || A.get() != B.get())
+        return false;
+    const token *Ta = A.args(), *Tb = B.args();
+    while (Ta != NULL && Tb != NULL) {
+        if (Ta->ttype != Tb->ttype || Ta->ID != Tb->ID || Ta->value != Tb->value ||
+            Ta->name != Tb->name || Ta->status != Tb->status)
+            return false;
+        Ta = Ta->next;
+        Tb = Tb->next;
+    }
+    return Ta == NULL && Tb == NULL;
+}
+
+static std::string line_of(edit_object &E)
+{
+    std::string line;
+    E.copy(0, E.length(), line);
+    return line;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int seed = (argc > 1) ? strtoul(argv[1],NULL,0) : 1;
+    srand(seed);
+
+    // not a terminal: run() parses the line without editing it
+    int fd = open("/dev/null", O_RDWR);
+    assert(fd >= 0);
+    terminal_driver &tdriver = terminal_driver::initialize(fd, fd);
+    assert(!tdriver.interactive());
+
+    digits_validator digits;
+    const validator::id_t vtype = validator::USER;
+    int e = validation::initialize().add_validator(vtype, &digits);
+    assert(e == 0);
+
+    command_catalog catalog(false);
+    load_commands(catalog, vtype);
+    commands session(tdriver, &catalog), fresh(tdriver, &catalog);
+    edit_object &E = session; // edits go through the virtual functions of the session
+
+    // an edit in one argument of a long line validates that argument only
+    std::string sum = "sum";
+    for (size_t i = 0; i < N_SUM; ++i) {
+        char arg[16];
+        snprintf(arg, sizeof(arg), " %zu", i);
+        sum += arg;
+    }
+    E.set(sum.c_str());
+    commands::status_t st = session.run();
+    size_t all = digits.checks;
+    E.left(sum.length() / 2);
+    E.insert('7');
+    commands::status_t st_edited = session.run();
+    size_t edited = digits.checks - all;
+    if (st != commands::VALID_COMMAND || st_edited != commands::VALID_COMMAND || all != N_SUM || edited != 1) {
+        fprintf(stderr, "sum: status %d/%d; %zu values checked, %zu after one edit\n", (int)st, (int)st_edited, all, edited);
+        return 1;
+    }
+
+    static const char alphabet[] = "throw bal angle=3 hard\"\\";
+    static const char *lines[] = {
+        "", "throw ball angle=30 hard bob \"hi there\"", "set ball color=\"red\" fast acme", "sum 1 2 3x 4",
+        "throw  ball   back", "\"throw\" ball", "throw ball angle = 9 x\\ y",
+    };
+
+    size_t n_checks = 0;
+    for (size_t round = 0; round < 2000; ++round) {
+        E.set(lines[rand() % (sizeof(lines) / sizeof(lines[0]))]);
+        E.left(rand() % 50);
+
+        for (size_t i = 0; i < 200; ++i) {
+            switch (rand() % 12) {
+            case 0: case 1: case 2: case 3: case 4:
+                E.insert(alphabet[rand() % (sizeof(alphabet) - 1)]);
+                break;
+            case 5: E.del(); break;
+            case 6: E.bksp(); break;
+            case 7: E.left(rand() % 5); break;
+            case 8: E.right(rand() % 5); break;
+            case 9: E.swap(); break;
+            case 10:
+                if (rand() % 8 == 0)
+                    E.wipe();
+                break;
+            case 11:
+                // full parse: sort() annotates the kept tokens and appends defaults
+                (void)session.run();
+                break;
+            }
+
+            if (rand() % 4 == 0) {
+                std::string line = line_of(E);
+                if (!session.check_tokens()) {
+                    fprintf(stderr, "seed %u, round %zu: tokens differ for [%s]\n", seed, round, line.c_str());
+                    return 1;
+                }
+                fresh.load(line);
+                if (!same_parse(session, fresh)) {
+                    fprintf(stderr, "seed %u, round %zu: parse differs for [%s]\n", seed, round, line.c_str());
+                    return 1;
+                }
+                ++n_checks;
+            }
+        }
+    }
+
+    printf("OK (%zu checks)\n", n_checks);
+    return 0;
+}
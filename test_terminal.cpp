@@ -0,0 +1,214 @@
+/*
+Copyright (C) 2013-2015 Roelof Nico du Toit.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// non-interactive check of the terminal driver + editor output path; the
+// editor runs on the slave side of a pseudo-terminal, and this program
+// plays the terminal on the master side (keys in, screen output out)
+
+#include "editor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+using namespace libchars;
+
+static int __master = -1;
+
+// unlike assert(), evaluated in every build: the checked calls drive the pty
+#define CHECK(x) check((x), #x, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        fprintf(stderr, "line %d: check failed: %s\n", line, what);
+        exit(1);
+    }
+}
+
+static void feed(const char *keys)
+{
+    size_t n = strlen(keys);
+    ssize_t r = write(__master, keys, n);
+    CHECK(r == (ssize_t)n);
+}
+
+static std::string drain()
+{
+    // output of the editor, until the master side has been quiet for a while
+    // (the pty delivers output asynchronously)
+    std::string out;
+    char buffer[4096];
+    struct pollfd pfd = { __master, POLLIN, 0 };
+    while (poll(&pfd, 1, 100) > 0) {
+        ssize_t r = read(__master, buffer, sizeof(buffer));
+        if (r > 0)
+            out.append(buffer, r);
+        else if (r < 0 && errno != EINTR && errno != EAGAIN)
+            break;
+    }
+    return out;
+}
+
+int main(void)
+{
+    __master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(__master >= 0);
+    int r = grantpt(__master);
+    CHECK(r == 0);
+    r = unlockpt(__master);
+    CHECK(r == 0);
+    int slave = open(ptsname(__master), O_RDWR | O_NOCTTY);
+    CHECK(slave >= 0);
+
+    struct winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_col = 40;
+    ws.ws_row = 10;
+    r = ioctl(slave, TIOCSWINSZ, &ws);
+    CHECK(r == 0);
+    fcntl(__master, F_SETFL, fcntl(__master, F_GETFL) | O_NONBLOCK);
+
+    // answer the cursor position requests that enable control sequences and
+    // confirm the window size
+    feed("\x1b[1;1R" "\x1b[10;40R");
+    terminal_driver &tdriver = terminal_driver::initialize(slave, slave);
+    CHECK(tdriver.interactive() && tdriver.control());
+    CHECK(tdriver.columns() == 40 && tdriver.rows() == 10);
+    drain();
+
+    // one frame: any number of sequences, one system call
+    std::string out;
+    size_t n0 = tdriver.write_syscalls();
+    tdriver.begin_frame();
+    tdriver.cursor_disable();
+    tdriver.write("abc", 3);
+    tdriver.begin_frame();
+    tdriver.cursor_left(2);
+    r = tdriver.end_frame();
+    CHECK(r == 0);
+    tdriver.cursor_enable();
+    CHECK(tdriver.write_syscalls() == n0);
+    r = tdriver.end_frame();
+    CHECK(r == 0);
+    CHECK(tdriver.write_syscalls() == n0 + 1);
+    out = drain();
+    CHECK(out == "\x1b[?25labc\x1b[2D\x1b[?25h");
+
+    // outside a frame: one system call per write
+    n0 = tdriver.write_syscalls();
+    tdriver.write("\r", 1);
+    tdriver.clear_to_end_of_screen();
+    CHECK(tdriver.write_syscalls() == n0 + 2);
+    drain();
+
+    // large payload in a frame: written at once together with the pending
+    // output (writev), without being copied into the frame buffer
+    std::string payload(2500, 'x');
+    n0 = tdriver.write_syscalls();
+    tdriver.begin_frame();
+    tdriver.cursor_disable();
+    r = tdriver.write(payload.data(), payload.length());
+    CHECK(r == 0);
+    CHECK(tdriver.write_syscalls() == n0 + 1); // not at end_frame()
+    r = tdriver.end_frame();
+    CHECK(r == 0);
+    CHECK(tdriver.write_syscalls() == n0 + 1);
+    out = drain();
+    CHECK(out == "\x1b[?25l" + payload);
+    tdriver.cursor_enable();
+    tdriver.write("\r", 1);
+    tdriver.clear_to_end_of_screen();
+    drain();
+
+    editor ed(tdriver);
+    edit_object O(MODE_COMMAND);
+    O.prompt = "> ";
+
+    // fresh line: the cursor position is unknown until the editor moves the
+    // cursor for the first time (after "hello world", on column 14)
+    feed("hello world" "\x1b[D" "\t" "\x1b[1;14R");
+    r = ed.edit(O);
+    CHECK(r == 0 && ed.key() == KEY_TAB);
+    CHECK(tdriver.cursor_known());
+    out = drain();
+    CHECK(out == "\x1b[0J> hello world\x1b[6n\x1b[1D");
+
+    // keys that arrive together are printed in one pass; a print() frame
+    // (cursor moves + changed cells) is one write
+    n0 = tdriver.write_syscalls();
+    feed("\x1b[D\x1b[DXY\t");
+    r = ed.edit(O);
+    CHECK(r == 0 && ed.key() == KEY_TAB);
+    CHECK(tdriver.write_syscalls() == n0 + 1);
+    CHECK(std::string(O.data(), O.length()) == "hello woXYrld");
+    out = drain();
+    CHECK(out.find("XYrld") != std::string::npos);
+
+    // one key, one print(), one write
+    n0 = tdriver.write_syscalls();
+    feed("\x7f");
+    feed("\t");
+    r = ed.edit(O);
+    CHECK(r == 0 && ed.key() == KEY_TAB);
+    CHECK(tdriver.write_syscalls() == n0 + 1);
+    CHECK(std::string(O.data(), O.length()) == "hello woXrld");
+    drain();
+
+    // window resized: the editor clears the screen and must redraw prompt +
+    // line in full, not as a difference with what used to be on screen
+    ws.ws_col = 30;
+    ws.ws_row = 8;
+    r = ioctl(__master, TIOCSWINSZ, &ws);
+    CHECK(r == 0);
+    usleep(500 * 1000); // driver polls the window size
+    feed("l\t");
+    r = ed.edit(O);
+    CHECK(r == 0 && ed.key() == KEY_TAB);
+    CHECK(tdriver.columns() == 30 && tdriver.rows() == 8);
+    CHECK(std::string(O.data(), O.length()) == "hello woXlrld");
+    out = drain();
+    size_t cleared = out.find("\x1b[2J");
+    CHECK(cleared != std::string::npos);
+    CHECK(out.find("\x1b[0J> ", cleared) != std::string::npos);
+    CHECK(out.find("hello woXrld", cleared) != std::string::npos);
+
+    // Alt+P / Alt+] (ESC + 'P' / ']') are 2-byte sequences, not the start of
+    // a control string that swallows the keys after it
+    ed.set_return_timeout(2);
+    feed("\x1bP" "a" "\x1b]" "b\t");
+    r = ed.edit(O);
+    CHECK(r == 0 && ed.key() == KEY_TAB);
+    ed.clear_return_timeout();
+    CHECK(std::string(O.data(), O.length()) == "hello woXlabrld");
+    drain();
+
+    tdriver.shutdown();
+    close(slave);
+    close(__master);
+
+    printf("OK\n");
+    return 0;
+}
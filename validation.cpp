@@ -111,14 +111,22 @@ namespace libchars {
                 case token::KEY:
                 case token::VALUE:
                     {
-                        const validator *v = validation::initialize().get_validator_by_id(T->vtype);
+                        // a token kept by the incremental lexer has the same value
+                        // as when it was checked; only tokens lexed anew are checked
+                        if (T->vtype != validator::NONE && T->checked_vtype != T->vtype) {
+                            const validator *v = validation::initialize().get_validator_by_id(T->vtype);
+                            if (v != NULL) {
+                                T->checked = v->check(T->value);
+                                T->checked_vtype = T->vtype;
+                            }
+                        }
                         //TODO: remove quotes from strings
                         T->status &= ~token::PARTIAL_ARG;
-                        if (v == NULL) {
-                            T->status |= token::VALIDATED;
+                        if (T->vtype == validator::NONE || T->checked_vtype != T->vtype) {
+                            T->status |= token::VALIDATED; // no validator
                         }
                         else {
-                            switch (v->check(T->value)) {
+                            switch (T->checked) {
                             case validator::INVALID:
                                 break;
                             case validator::PARTIAL:
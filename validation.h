@@ -53,7 +53,7 @@ namespace libchars {
     class validation
     {
     private:
-        validation() : generator(validator::AUTO) {}
+        validation() : generator(validator::AUTO) { initialize__(); }
         ~validation() {}
 
         validation(validation const&);
@@ -72,8 +72,7 @@ namespace libchars {
     public:
         static validation& initialize()
         {
-            static validation instance;
-            instance.initialize__();
+            static validation instance; // initialized once, also when first used by several threads
             return instance;
         }
 